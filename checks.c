@@ -18,6 +18,8 @@
  *                                                                   USA
  */
 
+#include <pthread.h>
+
 #include "dtc.h"
 
 #ifdef TRACE_CHECKS
@@ -54,6 +56,10 @@ struct check {
 	bool warn, error;
 	enum checkstatus status;
 	bool inprogress;
+	bool done, failed;
+	struct data msgs;
+	double time;			/* statistics, for --check-stats */
+	unsigned long nodes, props, failures;
 	int num_prereqs;
 	struct check **prereq;
 };
@@ -104,86 +110,37 @@ static inline void check_msg(struct check *c, const char *fmt, ...) __attribute_
 static inline void check_msg(struct check *c, const char *fmt, ...)
 {
 	va_list ap;
-	va_start(ap, fmt);
+	const char *level = (c->error) ? "ERROR" : "Warning";
+	const char *file = batch_input ? batch_input : "";
+	const char *sep = batch_input ? ": " : "";
+	int len;
 
-	if ((c->warn && (quiet < 1))
-	    || (c->error && (quiet < 2))) {
-		fprintf(stderr, "%s (%s): ",
-			(c->error) ? "ERROR" : "Warning", c->name);
-		vfprintf(stderr, fmt, ap);
-		fprintf(stderr, "\n");
-	}
+	if (!((c->warn && (quiet < 1))
+	      || (c->error && (quiet < 2))))
+		return;
+
+	/* Messages are held until process_checks() shows them */
+	va_start(ap, fmt);
+	len = snprintf(NULL, 0, "%s%s%s (%s): ", file, sep, level, c->name)
+		+ vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	c->msgs = data_grow_for(c->msgs, len + 2);
+	c->msgs.len += sprintf(c->msgs.val + c->msgs.len, "%s%s%s (%s): ",
+			       file, sep, level, c->name);
+	va_start(ap, fmt);
+	c->msgs.len += vsprintf(c->msgs.val + c->msgs.len, fmt, ap);
 	va_end(ap);
+	c->msgs.val[c->msgs.len++] = '\n';
 }
 
 #define FAIL(c, ...) \
 	do { \
 		TRACE((c), "\t\tFAILED at %s:%d", __FILE__, __LINE__); \
-		(c)->status = FAILED; \
+		(c)->failed = true; \
+		(c)->failures++; \
 		check_msg((c), __VA_ARGS__); \
 	} while (0)
 
-static void check_nodes_props(struct check *c, struct node *dt, struct node *node)
-{
-	struct node *child;
-	struct property *prop;
-
-	TRACE(c, "%s", node->fullpath);
-	if (c->node_fn)
-		c->node_fn(c, dt, node);
-
-	if (c->prop_fn)
-		for_each_property(node, prop) {
-			TRACE(c, "%s\t'%s'", node->fullpath, prop->name);
-			c->prop_fn(c, dt, node, prop);
-		}
-
-	for_each_child(node, child)
-		check_nodes_props(c, dt, child);
-}
-
-static bool run_check(struct check *c, struct node *dt)
-{
-	bool error = false;
-	int i;
-
-	assert(!c->inprogress);
-
-	if (c->status != UNCHECKED)
-		goto out;
-
-	c->inprogress = true;
-
-	for (i = 0; i < c->num_prereqs; i++) {
-		struct check *prq = c->prereq[i];
-		error = error || run_check(prq, dt);
-		if (prq->status != PASSED) {
-			c->status = PREREQ;
-			check_msg(c, "Failed prerequisite '%s'",
-				  c->prereq[i]->name);
-		}
-	}
-
-	if (c->status != UNCHECKED)
-		goto out;
-
-	if (c->node_fn || c->prop_fn)
-		check_nodes_props(c, dt, dt);
-
-	if (c->tree_fn)
-		c->tree_fn(c, dt);
-	if (c->status == UNCHECKED)
-		c->status = PASSED;
-
-	TRACE(c, "\tCompleted, status %d", c->status);
-
-out:
-	c->inprogress = false;
-	if ((c->status != PASSED) && (c->error))
-		error = true;
-	return error;
-}
-
 /*
  * Utility check functions
  */
@@ -243,12 +200,10 @@ static void check_duplicate_node_names(struct check *c, struct node *dt,
 	struct node *child, *child2;
 
 	for_each_child(node, child)
-		for (child2 = child->next_sibling;
+		for (child2 = get_duplicate_subnode(node, child);
 		     child2;
-		     child2 = child2->next_sibling)
-			if (streq(child->name, child2->name))
-				FAIL(c, "Duplicate node name %s",
-				     child->fullpath);
+		     child2 = get_duplicate_subnode(node, child2))
+			FAIL(c, "Duplicate node name %s", child->fullpath);
 }
 NODE_ERROR(duplicate_node_names, NULL);
 
@@ -258,12 +213,13 @@ static void check_duplicate_property_names(struct check *c, struct node *dt,
 	struct property *prop, *prop2;
 
 	for_each_property(node, prop) {
-		for (prop2 = prop->next; prop2; prop2 = prop2->next) {
+		for (prop2 = get_duplicate_property(node, prop);
+		     prop2;
+		     prop2 = get_duplicate_property(node, prop2)) {
 			if (prop2->deleted)
 				continue;
-			if (streq(prop->name, prop2->name))
-				FAIL(c, "Duplicate property name %s in %s",
-				     prop->name, node->fullpath);
+			FAIL(c, "Duplicate property name %s in %s",
+			     prop->name, node->fullpath);
 		}
 	}
 }
@@ -416,7 +372,7 @@ static void check_explicit_phandles(struct check *c, struct node *root,
 		return;
 	}
 
-	node->phandle = phandle;
+	set_node_phandle(root, node, phandle);
 }
 PROP_ERROR(explicit_phandles, NULL);
 
@@ -442,9 +398,11 @@ static void check_name_properties(struct check *c, struct node *root,
 		/* The name property is correct, and therefore redundant.
 		 * Delete it */
 		*pp = prop->next;
-		free(prop->name);
+		invalidate_label_index();
+		invalidate_name_index(node);
+		arena_free(prop->name);
 		data_free(prop->val);
-		free(prop);
+		arena_free(prop);
 	}
 }
 ERROR_IF_NOT_STRING(name_is_string, "name");
@@ -734,17 +692,330 @@ void parse_checks_option(bool warn, bool error, const char *arg)
 	die("Unrecognized check name \"%s\"\n", name);
 }
 
+/*
+ * Checks which change the tree in a way that other checks, or the output,
+ * can see. Each of these is run in a traversal of its own.
+ */
+static struct check *fixup_table[] = {
+	&explicit_phandles, &name_properties, &phandle_references,
+	&path_references,
+};
+
+static bool is_fixup(struct check *c)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fixup_table); i++)
+		if (fixup_table[i] == c)
+			return true;
+	return false;
+}
+
+static void show_msgs(struct check *c)
+{
+	fwrite(c->msgs.val, 1, c->msgs.len, stderr);
+	data_free(c->msgs);
+	c->msgs = empty_data;
+}
+
+/*
+ * Work out the outcome of a check as if the checks were run one at a
+ * time, using the results of the traversals so far. If a check that is
+ * needed has not been run yet, it is returned in *next and nothing more
+ * is done. With show set, messages appear in the order they would have
+ * done had each check walked the tree by itself.
+ */
+static bool run_check(struct check *c, bool show, struct check **next)
+{
+	bool error = false;
+	int i;
+
+	assert(!c->inprogress);
+
+	if (c->status != UNCHECKED)
+		goto out;
+
+	c->inprogress = true;
+
+	for (i = 0; i < c->num_prereqs; i++) {
+		struct check *prq = c->prereq[i];
+		error = error || run_check(prq, show, next);
+		if (*next)
+			goto out;
+		if (prq->status != PASSED) {
+			c->status = PREREQ;
+			if (show) {
+				check_msg(c, "Failed prerequisite '%s'",
+					  c->prereq[i]->name);
+				show_msgs(c);
+			}
+		}
+	}
+
+	if (c->status != UNCHECKED)
+		goto out;
+
+	if (!c->done) {
+		*next = c;
+		goto out;
+	}
+
+	if (show)
+		show_msgs(c);
+	c->status = c->failed ? FAILED : PASSED;
+
+	TRACE(c, "\tCompleted, status %d", c->status);
+
+out:
+	c->inprogress = false;
+	if ((c->status != PASSED) && (c->error))
+		error = true;
+	return error;
+}
+
+static bool run_checks(struct check **order, int count, bool show,
+		       struct check **next)
+{
+	bool error = false;
+	int i;
+
+	for (i = 0; i < count; i++)
+		order[i]->status = UNCHECKED;
+
+	*next = NULL;
+	for (i = 0; i < ARRAY_SIZE(check_table) && !*next; i++) {
+		struct check *c = check_table[i];
+
+		if (c->warn || c->error)
+			error = error || run_check(c, show, next);
+	}
+	return error;
+}
+
+/* Put a check after its prerequisites, in the order run_check() visits them */
+static void add_check(struct check *c, struct check **order, int *count)
+{
+	int i;
+
+	for (i = 0; i < *count; i++)
+		if (order[i] == c)
+			return;
+	for (i = 0; i < c->num_prereqs; i++)
+		add_check(c->prereq[i], order, count);
+	assert(*count < ARRAY_SIZE(check_table));
+	order[(*count)++] = c;
+	c->done = c->failed = false;
+}
+
+/*
+ * Pick the checks to run along with next, the first one that is still
+ * needed: those later in the order whose prerequisites have all passed,
+ * up to the next fixup. Since nothing before a fixup changes the tree,
+ * each check sees it as it would when run by itself. Nothing after a
+ * check that has already failed with an error is picked, since once it
+ * is reached no more checks are run.
+ */
+static int pick_checks(struct check *next, struct check **order, int count,
+		       struct check **batch)
+{
+	int i, j, n = 0;
+
+	batch[n++] = next;
+	if (is_fixup(next))
+		return n;
+
+	for (i = 0; order[i] != next; i++)
+		;
+	for (i++; i < count; i++) {
+		struct check *c = order[i];
+
+		if (is_fixup(c) || (c->done && c->failed && c->error))
+			break;
+		for (j = 0; j < c->num_prereqs; j++)
+			if (!c->prereq[j]->done || c->prereq[j]->failed)
+				break;
+		if (!c->done && j == c->num_prereqs)
+			batch[n++] = c;
+	}
+	return n;
+}
+
+/* Call a check's function on a node, keeping statistics if wanted */
+static void call_node_fn(struct check *c, struct node *dt, struct node *node)
+{
+	double start;
+
+	if (c->node_fn || c->prop_fn)
+		c->nodes++;
+	if (!c->node_fn)
+		return;
+	if (stats_format == STATS_NONE) {
+		c->node_fn(c, dt, node);
+		return;
+	}
+	start = util_now();
+	c->node_fn(c, dt, node);
+	c->time += util_now() - start;
+}
+
+static void call_prop_fn(struct check *c, struct node *dt, struct node *node,
+			 struct property *prop)
+{
+	double start;
+
+	c->props++;
+	if (stats_format == STATS_NONE) {
+		c->prop_fn(c, dt, node, prop);
+		return;
+	}
+	start = util_now();
+	c->prop_fn(c, dt, node, prop);
+	c->time += util_now() - start;
+}
+
+static void call_tree_fn(struct check *c, struct node *dt)
+{
+	double start;
+
+	if (!c->tree_fn)
+		return;
+	if (stats_format == STATS_NONE) {
+		c->tree_fn(c, dt);
+		return;
+	}
+	start = util_now();
+	c->tree_fn(c, dt);
+	c->time += util_now() - start;
+}
+
+static void check_nodes_props(struct check **batch, int n, struct node *dt,
+			      struct node *node)
+{
+	struct node *child;
+	struct property *prop;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct check *c = batch[i];
+
+		TRACE(c, "%s", node->fullpath);
+		call_node_fn(c, dt, node);
+	}
+
+	for_each_property(node, prop)
+		for (i = 0; i < n; i++) {
+			struct check *c = batch[i];
+
+			if (c->prop_fn) {
+				TRACE(c, "%s\t'%s'", node->fullpath,
+				      prop->name);
+				call_prop_fn(c, dt, node, prop);
+			}
+		}
+
+	for_each_child(node, child)
+		check_nodes_props(batch, n, dt, child);
+}
+
+/* Run a group of checks together, with a single walk of the tree */
+static void run_group(struct check **group, int n, struct node *dt)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (group[i]->node_fn || group[i]->prop_fn)
+			break;
+	if (i < n)
+		check_nodes_props(group, n, dt, dt);
+
+	for (i = 0; i < n; i++) {
+		call_tree_fn(group[i], dt);
+		group[i]->done = true;
+	}
+}
+
+struct check_thread {
+	pthread_t thread;
+	struct check **group;
+	int n;
+	struct node *dt;
+};
+
+static void *check_thread_fn(void *arg)
+{
+	struct check_thread *t = arg;
+
+	run_group(t->group, t->n, t->dt);
+	return NULL;
+}
+
+/*
+ * Run a batch of checks, sharing them out between up to 'jobs' threads.
+ * None of them changes the tree (see fixup_table), so once its indexes
+ * are up to date each thread can walk it at the same time.
+ */
+static void run_batch(struct check **batch, int n, struct node *dt)
+{
+	struct check_thread *t;
+	int i, nthreads = (jobs < n) ? jobs : n;
+
+	if (nthreads < 2) {
+		run_group(batch, n, dt);
+		return;
+	}
+
+	index_tree(dt);
+	t = xmalloc(nthreads * sizeof(*t));
+	for (i = 0; i < nthreads; i++) {
+		t[i].group = batch + i * n / nthreads;
+		t[i].n = (i + 1) * n / nthreads - i * n / nthreads;
+		t[i].dt = dt;
+	}
+
+	/* The first group runs here; any thread we can't start does too */
+	for (i = 1; i < nthreads; i++)
+		if (pthread_create(&t[i].thread, NULL, check_thread_fn, &t[i]))
+			t[i].n = 0;
+	run_group(t[0].group, t[0].n, dt);
+	for (i = 1; i < nthreads; i++) {
+		if (t[i].n)
+			pthread_join(t[i].thread, NULL);
+		else
+			run_group(t[i].group, (i + 1) * n / nthreads
+				  - i * n / nthreads, dt);
+	}
+	free(t);
+}
+
 void process_checks(bool force, struct boot_info *bi)
 {
 	struct node *dt = bi->dt;
-	int i;
-	int error = 0;
+	struct check *order[ARRAY_SIZE(check_table)];
+	struct check *batch[ARRAY_SIZE(check_table)];
+	struct check *next;
+	int i, count = 0;
+	int error;
 
 	for (i = 0; i < ARRAY_SIZE(check_table); i++) {
 		struct check *c = check_table[i];
 
 		if (c->warn || c->error)
-			error = error || run_check(c, dt);
+			add_check(c, order, &count);
+	}
+
+	while (run_checks(order, count, false, &next), next)
+		run_batch(batch, pick_checks(next, order, count, batch), dt);
+	error = run_checks(order, count, true, &next);
+
+	/* Forget checks that ran in a batch but were never reached */
+	for (i = 0; i < count; i++) {
+		struct check *c = order[i];
+
+		if (c->done && c->status == UNCHECKED) {
+			c->done = false;
+			data_free(c->msgs);
+			c->msgs = empty_data;
+		}
 	}
 
 	if (error) {
@@ -758,3 +1029,34 @@ void process_checks(bool force, struct boot_info *bi)
 		}
 	}
 }
+
+void print_check_stats(FILE *f)
+{
+	int i, n = 0;
+
+	if (stats_format == STATS_TEXT)
+		fprintf(f, "%-40s %10s %8s %8s %8s\n", "Check", "Time (ms)",
+			"Nodes", "Props", "Failures");
+	else
+		fprintf(f, "[");
+
+	for (i = 0; i < ARRAY_SIZE(check_table); i++) {
+		struct check *c = check_table[i];
+
+		if (!c->done)
+			continue;
+		if (stats_format == STATS_TEXT)
+			fprintf(f, "%-40s %10.3f %8lu %8lu %8lu\n", c->name,
+				c->time * 1000, c->nodes, c->props,
+				c->failures);
+		else
+			fprintf(f, "%s\n    {\"name\": \"%s\", \"time_ms\": %.3f, "
+				"\"nodes\": %lu, \"props\": %lu, "
+				"\"failures\": %lu}", n++ ? "," : "", c->name,
+				c->time * 1000, c->nodes, c->props,
+				c->failures);
+	}
+
+	if (stats_format == STATS_JSON)
+		fprintf(f, "\n  ]");
+}
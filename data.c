@@ -27,12 +27,12 @@ void data_free(struct data d)
 	m = d.markers;
 	while (m) {
 		nm = m->next;
-		free(m->ref);
-		free(m);
+		arena_free(m->ref);
+		arena_free(m);
 		m = nm;
 	}
 
-	if (d.val)
+	if (d.capacity)
 		free(d.val);
 }
 
@@ -41,17 +41,30 @@ struct data data_grow_for(struct data d, int xlen)
 	struct data nd;
 	int newsize;
 
-	if (xlen == 0)
+	if ((d.len + xlen) <= d.capacity)
 		return d;
 
 	nd = d;
 
-	newsize = xlen;
+	/*
+	 * Grow geometrically, so that appending is amortised O(1). Borrowed
+	 * data is copied even when nothing is appended, and the early return
+	 * above means newsize can't start at zero.
+	 */
+	newsize = d.capacity ? d.capacity : d.len + xlen;
 
 	while ((d.len + xlen) > newsize)
 		newsize *= 2;
 
-	nd.val = xrealloc(d.val, newsize);
+	if (d.capacity) {
+		nd.val = xrealloc(d.val, newsize);
+	} else {
+		/* Borrowed, so make our own copy before changing it */
+		nd.val = xmalloc(newsize);
+		if (d.len)
+			memcpy(nd.val, d.val, d.len);
+	}
+	nd.capacity = newsize;
 
 	return nd;
 }
@@ -68,6 +81,26 @@ struct data data_copy_mem(const char *mem, int len)
 	return d;
 }
 
+/* Make a separate copy of some data, including its markers */
+struct data data_copy(struct data d)
+{
+	struct data nd = empty_data;
+	struct marker *m = d.markers, **mp = &nd.markers;
+
+	if (d.len)
+		nd = data_copy_mem(d.val, d.len);
+
+	for_each_marker(m) {
+		*mp = arena_alloc(sizeof(**mp));
+		(*mp)->offset = m->offset;
+		(*mp)->type = m->type;
+		(*mp)->ref = arena_strdup(m->ref);
+		mp = &(*mp)->next;
+	}
+
+	return nd;
+}
+
 struct data data_copy_escape_string(const char *s, int len)
 {
 	int i = 0;
@@ -156,6 +189,12 @@ struct data data_merge(struct data d1, struct data d2)
 	struct data d;
 	struct marker *m2 = d2.markers;
 
+	/* Nothing to merge into, so avoid copying what may be a large value */
+	if (!d1.len && !d1.markers) {
+		data_free(d1);
+		return d2;
+	}
+
 	d = data_append_markers(data_append_data(d1, d2.val, d2.len), m2);
 
 	/* Adjust for the length of d1 */
@@ -241,11 +280,10 @@ struct data data_add_marker(struct data d, enum markertype type, char *ref)
 {
 	struct marker *m;
 
-	m = xmalloc(sizeof(*m));
+	m = arena_alloc(sizeof(*m));
 	m->offset = d.len;
 	m->type = type;
 	m->ref = ref;
-	m->next = NULL;
 
 	return data_append_markers(d, m);
 }
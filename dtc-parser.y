@@ -23,18 +23,22 @@
 #include "dtc.h"
 #include "srcpos.h"
 
-extern int yylex(void);
-extern void yyerror(char const *s);
 #define ERROR(loc, ...) \
 	do { \
 		srcpos_error((loc), "Error", __VA_ARGS__); \
-		treesource_error = true; \
+		ctx->error = true; \
 	} while (0)
-
-extern struct boot_info *the_boot_info;
-extern bool treesource_error;
 %}
 
+/* For %define api.pure full and %param */
+%require "2.7"
+%define api.pure full
+%locations
+%param {struct parse_context *ctx}
+%initial-action {
+	@$.file = ctx->srcfile;
+}
+
 %union {
 	char *propnodename;
 	char *labelref;
@@ -52,6 +56,13 @@ extern bool treesource_error;
 	struct node *nodelist;
 	struct reserve_info *re;
 	uint64_t integer;
+	struct fragment *fragment;
+	struct fragment_op *fragop;
+}
+
+%code {
+extern int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, struct parse_context *ctx);
+extern void yyerror(YYLTYPE *llocp, struct parse_context *ctx, char const *s);
 }
 
 %token DT_V1
@@ -68,6 +79,8 @@ extern bool treesource_error;
 %token <labelref> DT_LABEL
 %token <labelref> DT_REF
 %token DT_INCBIN
+%token <fragment> DT_INCLUDE
+%token DT_FRAGMENT
 
 %type <data> propdata
 %type <data> propdataprefix
@@ -79,6 +92,8 @@ extern bool treesource_error;
 %type <proplist> proplist
 
 %type <node> devicetree
+%type <fragop> fragmentop
+%type <fragop> fragmentops
 %type <node> nodedef
 %type <node> subnode
 %type <nodelist> subnodes
@@ -103,8 +118,50 @@ extern bool treesource_error;
 sourcefile:
 	  DT_V1 ';' memreserves devicetree
 		{
-			the_boot_info = build_boot_info($3, $4,
-							guess_boot_cpuid($4));
+			ctx->boot_info = build_boot_info($3, $4,
+							 guess_boot_cpuid($4));
+		}
+	| DT_FRAGMENT fragmentops
+		{
+			ctx->fragment_ops = $2;
+		}
+	;
+
+fragmentops:
+	  /* empty */
+		{
+			$$ = NULL;
+		}
+	| fragmentop fragmentops
+		{
+			$$ = chain_fragment_op($1, $2);
+		}
+	;
+
+fragmentop:
+	  '/' nodedef
+		{
+			$$ = build_fragment_op(FRAGMENT_ROOT, NULL, NULL, $2,
+					       &@1);
+		}
+	| DT_LABEL DT_REF nodedef
+		{
+			$$ = build_fragment_op(FRAGMENT_REF, $1, $2, $3, &@2);
+		}
+	| DT_REF nodedef
+		{
+			$$ = build_fragment_op(FRAGMENT_REF, NULL, $1, $2, &@1);
+		}
+	| DT_DEL_NODE DT_REF ';'
+		{
+			$$ = build_fragment_op(FRAGMENT_DELETE, NULL, $2, NULL,
+					       &@2);
+		}
+	| DT_INCLUDE
+		{
+			$$ = build_fragment_op(FRAGMENT_INCLUDE, NULL, NULL,
+					       NULL, &@1);
+			$$->include = $1;
 		}
 	;
 
@@ -136,6 +193,14 @@ devicetree:
 		{
 			$$ = name_node($2, "");
 		}
+	| DT_INCLUDE
+		{
+			$$ = apply_fragment(ctx, NULL, $1);
+		}
+	| devicetree DT_INCLUDE
+		{
+			$$ = apply_fragment(ctx, $1, $2);
+		}
 	| devicetree '/' nodedef
 		{
 			$$ = merge_nodes($1, $3);
@@ -233,7 +298,8 @@ propdata:
 		}
 	| propdataprefix DT_INCBIN '(' DT_STRING ',' integer_prim ',' integer_prim ')'
 		{
-			FILE *f = srcfile_relative_open($4.val, NULL);
+			FILE *f = srcfile_relative_open(ctx->srcfile, $4.val,
+							NULL);
 			struct data d;
 
 			if ($6 != 0)
@@ -249,7 +315,8 @@ propdata:
 		}
 	| propdataprefix DT_INCBIN '(' DT_STRING ')'
 		{
-			FILE *f = srcfile_relative_open($4.val, NULL);
+			FILE *f = srcfile_relative_open(ctx->srcfile, $4.val,
+							NULL);
 			struct data d = empty_data;
 
 			d = data_copy_file(f, -1);
@@ -471,7 +538,7 @@ subnode:
 
 %%
 
-void yyerror(char const *s)
+void yyerror(YYLTYPE *llocp, struct parse_context *ctx, char const *s)
 {
-	ERROR(&yylloc, "%s", s);
+	ERROR(llocp, "%s", s);
 }
@@ -18,6 +18,8 @@
  *                                                                   USA
  */
 
+#include <sys/resource.h>
+
 #include "dtc.h"
 #include "srcpos.h"
 
@@ -29,6 +31,64 @@ int reservenum;		/* Number of memory reservation slots */
 int minsize;		/* Minimum blob size */
 int padsize;		/* Additional padding to blob */
 int phandle_format = PHANDLE_BOTH;	/* Use linux,phandle or phandle properties */
+int jobs = 1;		/* Number of threads to run checks and flatten on */
+int stats_format = STATS_NONE;	/* How to print statistics, if at all */
+
+const char *batch_input;
+
+/* Time taken by each phase of the compilation, for --check-stats */
+static struct {
+	const char *name;
+	double time;
+} phases[8];
+static int num_phases;
+static double phase_start;
+
+/* Phases are added up by name, so that --batch gives totals */
+static void end_phase(const char *name)
+{
+	double now = util_now();
+	int i;
+
+	for (i = 0; i < num_phases; i++)
+		if (streq(phases[i].name, name))
+			break;
+	if ((i == num_phases) && (num_phases < ARRAY_SIZE(phases))) {
+		phases[i].name = name;
+		num_phases++;
+	}
+	if (i < num_phases)
+		phases[i].time += now - phase_start;
+	phase_start = now;
+}
+
+/* Called at exit, so that runs which stop on an error are covered too */
+static void print_stats(void)
+{
+	struct rusage ru;
+	int i;
+
+	getrusage(RUSAGE_SELF, &ru);
+	if (stats_format == STATS_TEXT) {
+		fprintf(stderr, "%-40s %10s\n", "Phase", "Time (ms)");
+		for (i = 0; i < num_phases; i++)
+			fprintf(stderr, "%-40s %10.3f\n", phases[i].name,
+				phases[i].time * 1000);
+		fprintf(stderr, "\n");
+		print_check_stats(stderr);
+		fprintf(stderr, "\nPeak memory use: %ld KB\n", ru.ru_maxrss);
+	} else {
+		fprintf(stderr, "{\n  \"phases\": [");
+		for (i = 0; i < num_phases; i++)
+			fprintf(stderr, "%s\n    {\"name\": \"%s\", "
+				"\"time_ms\": %.3f}", i ? "," : "",
+				phases[i].name, phases[i].time * 1000);
+		fprintf(stderr, "\n  ],\n  \"checks\": ");
+		print_check_stats(stderr);
+		fprintf(stderr, ",\n  \"peak_memory_kb\": %ld\n}\n",
+			ru.ru_maxrss);
+	}
+}
 
 static void fill_fullpaths(struct node *tree, const char *prefix)
 {
@@ -50,8 +110,15 @@ static void fill_fullpaths(struct node *tree, const char *prefix)
 /* Usage related data. */
 #define FDT_VERSION(version)	_FDT_VERSION(version)
 #define _FDT_VERSION(version)	#version
+#define OPT_NO_ARENA	0x100	/* long option only */
+#define OPT_CHECK_STATS	0x101	/* long option only */
+#define OPT_BATCH	0x102	/* long option only */
+#define OPT_PRECOMPILE	0x103	/* long option only */
+#define OPT_SERVER	0x104	/* long option only */
+#define OPT_PASS_THROUGH 0x105	/* long option only */
+
 static const char usage_synopsis[] = "dtc [options] <input file>";
-static const char usage_short_opts[] = "qI:O:o:V:d:R:S:p:fb:i:H:sW:E:hv";
+static const char usage_short_opts[] = "qI:O:o:V:d:R:S:p:fb:i:H:sW:E:j:hv";
 static struct option const usage_long_opts[] = {
 	{"quiet",            no_argument, NULL, 'q'},
 	{"in-format",         a_argument, NULL, 'I'},
@@ -69,6 +136,13 @@ static struct option const usage_long_opts[] = {
 	{"phandle",           a_argument, NULL, 'H'},
 	{"warning",           a_argument, NULL, 'W'},
 	{"error",             a_argument, NULL, 'E'},
+	{"jobs",              a_argument, NULL, 'j'},
+	{"no-arena",         no_argument, NULL, OPT_NO_ARENA},
+	{"check-stats",       a_argument, NULL, OPT_CHECK_STATS},
+	{"batch",             a_argument, NULL, OPT_BATCH},
+	{"precompile",       no_argument, NULL, OPT_PRECOMPILE},
+	{"server",            a_argument, NULL, OPT_SERVER},
+	{"pass-through",     no_argument, NULL, OPT_PASS_THROUGH},
 	{"help",             no_argument, NULL, 'h'},
 	{"version",          no_argument, NULL, 'v'},
 	{NULL,               no_argument, NULL, 0x0},
@@ -99,24 +173,182 @@ static const char * const usage_opts_help[] = {
 	 "\t\tboth   - Both \"linux,phandle\" and \"phandle\" properties",
 	"\n\tEnable/disable warnings (prefix with \"no-\")",
 	"\n\tEnable/disable errors (prefix with \"no-\")",
+	"\n\tRun checks, and flatten the tree for dtb output, on <number> threads",
+	"\n\tAllocate each tree object separately, rather than from an arena\n"
+	 "\t(for comparing memory use and speed)",
+	"\n\tPrint the time taken by each phase and check, the number of nodes\n"
+	 "\tand properties each check visited, and peak memory use, to stderr.\n"
+	 "\tFormats are:\n"
+	 "\t\ttext - a table for reading\n"
+	 "\t\tjson - a JSON object",
+	"\n\tCompile each input file listed in <file> to the output file\n"
+	 "\tnamed after it on the same line. Files included by several inputs\n"
+	 "\tbetween top-level statements are only parsed once. Check messages\n"
+	 "\tstart with the input they are about. The first input which fails\n"
+	 "\tstops the batch, leaving the inputs after it uncompiled",
+	"\n\tPrecompile the input, a file to be included, to the output file\n"
+	 "\t(by default, the input file name with \"" PRECOMPILED_SUFFIX
+	 "\" added).\n"
+	 "\tWhen /include/ names the input file, the precompiled file is used\n"
+	 "\tinstead, as long as none of the files it came from have changed",
+	"\n\tServe requests to compile on the UNIX socket <socket>, keeping\n"
+	 "\tincluded files parsed between them. Runs of dtc with DTC_SERVER\n"
+	 "\tset to <socket> have the server do their work, with their own\n"
+	 "\toptions. No other options may be given with this one",
+	"\n\tWith -I dtb -O dtb, copy the blob's blocks rather than building\n"
+	 "\ta tree from them and flattening it again, unless the tree must\n"
+	 "\tchange (as with -s). Only the blob's structure is checked, and\n"
+	 "\tthe blocks are kept as they are, including any NOPs",
 	"\n\tPrint this help and exit",
 	"\n\tPrint version and exit",
 	NULL,
 };
 
-int main(int argc, char *argv[])
+/* Options which apply to every input file */
+static const char *inform = "dts";
+static const char *outform = "dts";
+static bool force, sort, pass_through;
+static int outversion = DEFAULT_FDT_VERSION;
+static long long cmdline_boot_cpuid = -1;
+
+/* Check the tree, and make any changes to it asked for */
+static void process_tree(struct boot_info *bi)
+{
+	if (cmdline_boot_cpuid != -1)
+		bi->boot_cpuid_phys = cmdline_boot_cpuid;
+
+	phase_start = util_now();
+	fill_fullpaths(bi->dt, "");
+	end_phase("fill_fullpaths");
+	build_label_index(bi->dt);
+	end_phase("build_label_index");
+	process_checks(force, bi);
+	end_phase("process_checks");
+
+	if (sort) {
+		sort_tree(bi);
+		end_phase("sort_tree");
+	}
+}
+
+static void compile(const char *inname, const char *outname)
+{
+	struct boot_info *bi = NULL;
+	char *blob = NULL, *outblob = NULL;
+	FILE *outf = NULL;
+
+	phase_start = util_now();
+	if (streq(inform, "dts"))
+		bi = dt_from_source(inname);
+	else if (streq(inform, "fs"))
+		bi = dt_from_fs(inname);
+	else if(streq(inform, "dtb")) {
+		blob = dt_read_blob(inname);
+		if (pass_through && streq(outform, "dtb") && !sort)
+			outblob = dt_copy_blob(blob, outversion,
+					       cmdline_boot_cpuid);
+		if (!outblob)
+			bi = dt_from_blob(blob);
+	} else
+		die("Unknown input format \"%s\"\n", inform);
+	end_phase("parse");
+
+	if (depfile) {
+		fputc('\n', depfile);
+		fclose(depfile);
+	}
+
+	if (bi)
+		process_tree(bi);
+
+	if (streq(outname, "-")) {
+		outf = stdout;
+	} else {
+		outf = fopen(outname, "wb");
+		if (! outf)
+			die("Couldn't open output file %s: %s\n",
+			    outname, strerror(errno));
+	}
+
+	if (outblob) {
+		dt_write_blob(outf, outblob);
+	} else if (streq(outform, "dts")) {
+		dt_to_source(outf, bi);
+	} else if (streq(outform, "dtb")) {
+		dt_to_blob(outf, bi, outversion);
+	} else if (streq(outform, "asm")) {
+		dt_to_asm(outf, bi, outversion);
+	} else if (streq(outform, "null")) {
+		/* do nothing */
+	} else {
+		die("Unknown output format \"%s\"\n", outform);
+	}
+	if (outf != stdout)
+		fclose(outf);
+	end_phase("output");
+
+	arena_release();
+	reset_trees();
+	if (blob)
+		utilfdt_unmap(blob);
+}
+
+/* Called at exit, to say which input stopped a batch */
+static void report_batch_input(void)
+{
+	if (batch_input)
+		fprintf(stderr, "dtc: --batch stopped at %s, without compiling "
+			"the inputs after it\n", batch_input);
+}
+
+/*
+ * Compile each pair of input and output files listed in a file, one pair
+ * to a line. Since everything is done in one process, files which several
+ * inputs include can be parsed once and shared: see parse_fragment(). An
+ * input which fails stops the batch, as it would stop a run of dtc.
+ */
+static void compile_batch(const char *listname)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t line_size = 0;
+	char **words;
+	int num_words, lineno = 0;
+
+	f = streq(listname, "-") ? stdin : fopen(listname, "r");
+	if (!f)
+		die("Couldn't open batch file %s: %s\n", listname,
+		    strerror(errno));
+
+	cache_includes = true;
+	atexit(report_batch_input);
+	while (getline(&line, &line_size, f) != -1) {
+		lineno++;
+		num_words = util_split_words(line, &words);
+		if (num_words == 2) {
+			batch_input = words[0];
+			compile(words[0], words[1]);
+			batch_input = NULL;
+		} else if (num_words)
+			die("%s:%d: Expected <input file> <output file>\n",
+			    listname, lineno);
+		free(words);
+	}
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+}
+
+static void __attribute__((noreturn)) run(int argc, char *argv[])
 {
-	struct boot_info *bi;
-	const char *inform = "dts";
-	const char *outform = "dts";
 	const char *outname = "-";
 	const char *depname = NULL;
-	bool force = false, sort = false;
+	const char *batchname = NULL;
+	const char *servername = NULL;
+	bool precompile = false;
 	const char *arg;
-	int opt;
-	FILE *outf = NULL;
-	int outversion = DEFAULT_FDT_VERSION;
-	long long cmdline_boot_cpuid = -1;
+	int opt, num_opts = 0;
 
 	quiet      = 0;
 	reservenum = 0;
@@ -124,6 +356,7 @@ int main(int argc, char *argv[])
 	padsize    = 0;
 
 	while ((opt = util_getopt_long()) != EOF) {
+		num_opts++;
 		switch (opt) {
 		case 'I':
 			inform = optarg;
@@ -187,6 +420,43 @@ int main(int argc, char *argv[])
 			parse_checks_option(false, true, optarg);
 			break;
 
+		case 'j':
+			jobs = strtol(optarg, NULL, 0);
+			if (jobs < 1)
+				die("Invalid argument \"%s\" to -j option\n",
+				    optarg);
+			break;
+
+		case OPT_NO_ARENA:
+			arena_enabled = false;
+			break;
+
+		case OPT_CHECK_STATS:
+			if (streq(optarg, "text"))
+				stats_format = STATS_TEXT;
+			else if (streq(optarg, "json"))
+				stats_format = STATS_JSON;
+			else
+				die("Invalid argument \"%s\" to --check-stats "
+				    "option\n", optarg);
+			break;
+
+		case OPT_BATCH:
+			batchname = optarg;
+			break;
+
+		case OPT_PRECOMPILE:
+			precompile = true;
+			break;
+
+		case OPT_SERVER:
+			servername = optarg;
+			break;
+
+		case OPT_PASS_THROUGH:
+			pass_through = true;
+			break;
+
 		case 'h':
 			usage(NULL);
 		default:
@@ -205,6 +475,31 @@ int main(int argc, char *argv[])
 	if (minsize && padsize)
 		die("Can't set both -p and -S\n");
 
+	if (batchname && ((optind < argc) || depname || !streq(outname, "-")
+			  || precompile))
+		die("Can't give an input file, -o, -d or --precompile with "
+		    "--batch\n");
+
+	/* Requests start from the server's state, so it must be the default */
+	if (servername) {
+		if ((optind < argc) || (num_opts > 1))
+			die("Can't give an input file or other options with "
+			    "--server\n");
+		serve(servername, run);
+	}
+
+	if (getenv("DTC_SERVER"))
+		run_on_server(getenv("DTC_SERVER"), argc, argv);
+
+	if (precompile && streq(outname, "-")) {
+		char *name = xmalloc(strlen(arg)
+				     + strlen(PRECOMPILED_SUFFIX) + 1);
+
+		strcpy(name, arg);
+		strcat(name, PRECOMPILED_SUFFIX);
+		outname = name;
+	}
+
 	if (depname) {
 		depfile = fopen(depname, "w");
 		if (!depfile)
@@ -213,49 +508,20 @@ int main(int argc, char *argv[])
 		fprintf(depfile, "%s:", outname);
 	}
 
-	if (streq(inform, "dts"))
-		bi = dt_from_source(arg);
-	else if (streq(inform, "fs"))
-		bi = dt_from_fs(arg);
-	else if(streq(inform, "dtb"))
-		bi = dt_from_blob(arg);
-	else
-		die("Unknown input format \"%s\"\n", inform);
-
-	if (depfile) {
-		fputc('\n', depfile);
-		fclose(depfile);
-	}
-
-	if (cmdline_boot_cpuid != -1)
-		bi->boot_cpuid_phys = cmdline_boot_cpuid;
-
-	fill_fullpaths(bi->dt, "");
-	process_checks(force, bi);
-
-	if (sort)
-		sort_tree(bi);
+	if (stats_format != STATS_NONE)
+		atexit(print_stats);
 
-	if (streq(outname, "-")) {
-		outf = stdout;
-	} else {
-		outf = fopen(outname, "wb");
-		if (! outf)
-			die("Couldn't open output file %s: %s\n",
-			    outname, strerror(errno));
-	}
-
-	if (streq(outform, "dts")) {
-		dt_to_source(outf, bi);
-	} else if (streq(outform, "dtb")) {
-		dt_to_blob(outf, bi, outversion);
-	} else if (streq(outform, "asm")) {
-		dt_to_asm(outf, bi, outversion);
-	} else if (streq(outform, "null")) {
-		/* do nothing */
-	} else {
-		die("Unknown output format \"%s\"\n", outform);
-	}
+	if (batchname)
+		compile_batch(batchname);
+	else if (precompile)
+		write_precompiled(outname, fragment_from_source(arg));
+	else
+		compile(arg, outname);
 
 	exit(0);
 }
+
+int main(int argc, char *argv[])
+{
+	run(argc, argv);
+}
@@ -54,11 +54,20 @@ extern int reservenum;		/* Number of memory reservation slots */
 extern int minsize;		/* Minimum blob size */
 extern int padsize;		/* Additional padding to blob */
 extern int phandle_format;	/* Use linux,phandle or phandle properties */
+extern int jobs;		/* Number of threads to run checks and flatten on */
+extern int stats_format;	/* How to print statistics, if at all */
+
+/* Input file --batch is compiling, named in check messages, or NULL */
+extern const char *batch_input;
 
 #define PHANDLE_LEGACY	0x1
 #define PHANDLE_EPAPR	0x2
 #define PHANDLE_BOTH	0x3
 
+#define STATS_NONE	0
+#define STATS_TEXT	1
+#define STATS_JSON	2
+
 typedef uint32_t cell_t;
 
 
@@ -83,6 +92,7 @@ struct  marker {
 
 struct data {
 	int len;
+	int capacity;		/* bytes allocated for val, 0 if borrowed */
 	char *val;
 	struct marker *markers;
 };
@@ -100,6 +110,7 @@ void data_free(struct data d);
 
 struct data data_grow_for(struct data d, int xlen);
 
+struct data data_copy(struct data d);
 struct data data_copy_mem(const char *mem, int len);
 struct data data_copy_escape_string(const char *s, int len);
 struct data data_copy_file(FILE *f, size_t len);
@@ -158,6 +169,8 @@ struct node {
 	int addr_cells, size_cells;
 
 	struct label *labels;
+
+	struct name_index *child_index, *prop_index;	/* see livetree.c */
 };
 
 #define for_each_label_withdel(l0, l) \
@@ -183,6 +196,11 @@ struct node {
 
 void add_label(struct label **labels, char *label);
 void delete_labels(struct label **labels);
+void build_label_index(struct node *tree);
+void invalidate_label_index(void);
+void invalidate_name_index(struct node *node);
+void index_tree(struct node *tree);
+void reset_trees(void);
 
 struct property *build_property(char *name, struct data val);
 struct property *build_property_delete(char *name);
@@ -192,6 +210,7 @@ struct property *reverse_properties(struct property *first);
 struct node *build_node(struct property *proplist, struct node *children);
 struct node *build_node_delete(void);
 struct node *name_node(struct node *node, char *name);
+struct node *copy_node(struct node *node);
 struct node *chain_node(struct node *first, struct node *list);
 struct node *merge_nodes(struct node *old_node, struct node *new_node);
 
@@ -210,10 +229,14 @@ struct property *get_property_by_label(struct node *tree, const char *label,
 struct marker *get_marker_label(struct node *tree, const char *label,
 				struct node **node, struct property **prop);
 struct node *get_subnode(struct node *node, const char *nodename);
+struct node *get_duplicate_subnode(struct node *node, struct node *child);
+struct property *get_duplicate_property(struct node *node,
+					struct property *prop);
 struct node *get_node_by_path(struct node *tree, const char *path);
 struct node *get_node_by_label(struct node *tree, const char *label);
 struct node *get_node_by_phandle(struct node *tree, cell_t phandle);
 struct node *get_node_by_ref(struct node *tree, const char *ref);
+void set_node_phandle(struct node *root, struct node *node, cell_t phandle);
 cell_t get_node_phandle(struct node *root, struct node *node);
 
 uint32_t guess_boot_cpuid(struct node *tree);
@@ -249,19 +272,133 @@ void sort_tree(struct boot_info *bi);
 
 void parse_checks_option(bool warn, bool error, const char *arg);
 void process_checks(bool force, struct boot_info *bi);
+void print_check_stats(FILE *f);
 
 /* Flattened trees */
 
 void dt_to_blob(FILE *f, struct boot_info *bi, int version);
 void dt_to_asm(FILE *f, struct boot_info *bi, int version);
+void dt_write_blob(FILE *f, char *blob);
+
+/*
+ * dt_read_blob() maps a blob, which must be released with utilfdt_unmap()
+ * once any tree read from it by dt_from_blob() is finished with, since the
+ * tree borrows its property values.
+ */
+char *dt_read_blob(const char *fname);
+struct boot_info *dt_from_blob(char *blob);
 
-struct boot_info *dt_from_blob(const char *fname);
+/*
+ * Lay a version 16 or later blob out again as the given version without
+ * unflattening it, as fdt_open_into() and fdt_pack() would, with any extra
+ * reserve map entries and padding asked for. Only the blob's structure is
+ * checked. The result is written with dt_write_blob(). Returns NULL if
+ * either version is too old for the blocks to be copied unchanged.
+ */
+char *dt_copy_blob(char *blob, int version, long long boot_cpuid);
 
 /* Tree source */
 
 void dt_to_source(FILE *f, struct boot_info *bi);
 struct boot_info *dt_from_source(const char *f);
 
+struct srcfile_state;
+
+/*
+ * The state of one parse of a source file, so that the scanner and parser
+ * keep nothing in global variables. The lexer's fields are only used in
+ * dtc-lexer.l.
+ */
+struct parse_context {
+	void *scanner;			/* flex's yyscan_t */
+	struct srcfile_state *srcfile;	/* innermost file being read */
+	struct boot_info *boot_info;	/* result for a whole source file */
+	struct fragment_op *fragment_ops;	/* result for a fragment */
+	bool error;			/* an error has been reported */
+
+	/* Lexer */
+	int dts_version;
+	int brace_depth;		/* nesting of the last token */
+	int last_token;
+	bool in_tree;			/* root node has been started */
+	bool fragment_start;		/* next token starts a fragment */
+	struct srcfile_state *fragment_file;	/* being parsed, if any */
+};
+
+void lexer_init(struct parse_context *ctx, bool fragment);
+void lexer_destroy(struct parse_context *ctx);
+
+/*
+ * When cache_includes is set, a file included between top-level statements
+ * is parsed by itself the first time it is seen, as a fragment: a list of
+ * the statements in it. Each later /include/ of the same file replays the
+ * list against the tree being built rather than reading the file again.
+ */
+enum fragment_op_type {
+	FRAGMENT_ROOT,		/* / { ... }; */
+	FRAGMENT_REF,		/* label: &ref { ... }; */
+	FRAGMENT_DELETE,	/* /delete-node/ &ref; */
+	FRAGMENT_INCLUDE,	/* /include/ of another fragment */
+};
+
+struct srcpos;
+struct dep_list;
+
+struct fragment_op {
+	enum fragment_op_type type;
+	char *label;			/* label to add to the target */
+	char *ref;			/* label or path of the target */
+	struct node *node;		/* node to merge into the target */
+	struct fragment *include;
+	struct srcpos *srcpos;		/* of the reference, for errors */
+	struct fragment_op *next;
+};
+
+struct fragment {
+	char *name;		/* full name of the file */
+	bool failed;		/* file must be read as text instead */
+	struct dep_list *deps;	/* files it was read from, itself first */
+	struct data search_path;	/* when it was read, borrowed */
+	struct fragment_op *ops;
+	char *image;		/* precompiled form it was read from, or NULL */
+	void *mem;		/* what read_precompiled() allocated */
+	struct fragment *next;
+};
+
+extern bool cache_includes;
+extern struct fragment *fragment_cache;	/* newest first */
+
+struct fragment_op *build_fragment_op(enum fragment_op_type type, char *label,
+				      char *ref, struct node *node,
+				      struct srcpos *srcpos);
+struct fragment_op *chain_fragment_op(struct fragment_op *first,
+				      struct fragment_op *list);
+struct fragment *find_fragment(const char *name);
+struct fragment *parse_fragment(struct parse_context *ctx, const char *name);
+struct fragment *fragment_from_source(const char *fname);
+bool fragment_starts_tree(struct fragment *f);
+struct node *apply_fragment(struct parse_context *ctx, struct node *tree,
+			    struct fragment *f);
+
+/* Precompiled include files */
+
+#define PRECOMPILED_SUFFIX	".pdt"	/* added to the include file's name */
+
+int precompile_fragment(struct fragment *f, struct data *image);
+void write_precompiled(const char *fname, struct fragment *f);
+struct fragment *read_precompiled(const char *name, char *buf, off_t len);
+void free_precompiled(struct fragment *f);
+struct fragment *load_precompiled(const char *name);
+bool fragment_changed(struct fragment *f);
+bool fragment_path_changed(struct fragment *f);
+
+/* Compile server */
+
+void serve(const char *sockname, void (*run)(int argc, char *argv[]))
+	__attribute__((noreturn));
+void run_on_server(const char *sockname, int argc, char *argv[])
+	__attribute__((noreturn));
+
 /* FS trees */
 
 struct boot_info *dt_from_fs(const char *dirname);
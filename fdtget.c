@@ -25,6 +25,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,8 +47,21 @@ struct display_info {
 	int size;		/* data size (1/2/4) */
 	enum display_mode mode;	/* display mode that we are using */
 	const char *default_val; /* default value if node/property not found */
+	char term;		/* character written after each result */
 };
 
+/**
+ * Write a string followed by the result terminator (normally newline)
+ *
+ * @param disp		Display information / options
+ * @param str		String to write
+ */
+static void show_line(struct display_info *disp, const char *str)
+{
+	fputs(str, stdout);
+	putchar(disp->term);
+}
+
 static void report_error(const char *where, int err)
 {
 	fprintf(stderr, "Error at '%s': %s\n", where, fdt_strerror(err));
@@ -115,11 +129,13 @@ static int show_data(struct display_info *disp, const char *data, int len)
 /**
  * List all properties in a node, one per line.
  *
+ * @param disp		Display information / options
  * @param blob		FDT blob
  * @param node		Node to display
  * @return 0 if ok, or FDT_ERR... if not.
  */
-static int list_properties(const void *blob, int node)
+static int list_properties(struct display_info *disp, const void *blob,
+			   int node)
 {
 	const struct fdt_property *data;
 	const char *name;
@@ -133,7 +149,7 @@ static int list_properties(const void *blob, int node)
 		data = fdt_get_property_by_offset(blob, prop, NULL);
 		name = fdt_string(blob, fdt32_to_cpu(data->nameoff));
 		if (name)
-			puts(name);
+			show_line(disp, name);
 		prop = fdt_next_property_offset(blob, prop);
 	} while (1);
 }
@@ -143,11 +159,13 @@ static int list_properties(const void *blob, int node)
 /**
  * List all subnodes in a node, one per line
  *
+ * @param disp		Display information / options
  * @param blob		FDT blob
  * @param node		Node to display
  * @return 0 if ok, or FDT_ERR... if not.
  */
-static int list_subnodes(const void *blob, int node)
+static int list_subnodes(struct display_info *disp, const void *blob,
+			 int node)
 {
 	int nextoffset;		/* next node offset from libfdt */
 	uint32_t tag;		/* current tag */
@@ -166,7 +184,7 @@ static int list_subnodes(const void *blob, int node)
 				if (*pathp == '\0')
 					pathp = "/";	/* root is nameless */
 				if (level == 1)
-					puts(pathp);
+					show_line(disp, pathp);
 			}
 			level++;
 			if (level >= MAX_LEVEL) {
@@ -211,11 +229,11 @@ static int show_data_for_item(const void *blob, struct display_info *disp,
 
 	switch (disp->mode) {
 	case MODE_LIST_PROPS:
-		err = list_properties(blob, node);
+		err = list_properties(disp, blob, node);
 		break;
 
 	case MODE_LIST_SUBNODES:
-		err = list_subnodes(blob, node);
+		err = list_subnodes(disp, blob, node);
 		break;
 
 	default:
@@ -225,9 +243,9 @@ static int show_data_for_item(const void *blob, struct display_info *disp,
 			if (show_data(disp, value, len))
 				err = -1;
 			else
-				printf("\n");
+				putchar(disp->term);
 		} else if (disp->default_val) {
-			puts(disp->default_val);
+			show_line(disp, disp->default_val);
 		} else {
 			report_error(property, len);
 			err = -1;
@@ -254,7 +272,7 @@ static int do_fdtget(struct display_info *disp, const char *filename,
 	const char *prop;
 	int i, node;
 
-	blob = utilfdt_read(filename);
+	blob = utilfdt_map(filename, NULL);
 	if (!blob)
 		return -1;
 
@@ -262,7 +280,7 @@ static int do_fdtget(struct display_info *disp, const char *filename,
 		node = fdt_path_offset(blob, arg[i]);
 		if (node < 0) {
 			if (disp->default_val) {
-				puts(disp->default_val);
+				show_line(disp, disp->default_val);
 				continue;
 			} else {
 				report_error(arg[i], node);
@@ -277,20 +295,127 @@ static int do_fdtget(struct display_info *disp, const char *filename,
 	return 0;
 }
 
+/**
+ * Run queries read from a script, one per line, against a blob
+ *
+ * Each line holds a node path and (unless listing properties or subnodes)
+ * a property name. The blob is read once and indexed, so that each path is
+ * found quickly. A failed query is reported and gives an empty result, so
+ * that the output stays in step with the queries.
+ *
+ * @param disp		Display information / options
+ * @param filename	Filename of blob file
+ * @param script	Filename of script, or "-" for stdin
+ * @param args_per_step	Number of words expected on each line
+ * @param return 0 if ok, -ve if any query failed
+ */
+static int do_fdtget_batch(struct display_info *disp, const char *filename,
+			   const char *script, int args_per_step)
+{
+	struct fdt_index index;
+	char *blob, *buf;
+	char *line = NULL;
+	size_t line_size = 0;
+	char **words = NULL;
+	int num_words, lineno = 0;
+	int node, size, err, ret = 0;
+	FILE *f;
+
+	blob = utilfdt_map(filename, NULL);
+	if (!blob)
+		return -1;
+
+	size = fdt_index_size(blob);
+	if (size < 0) {
+		report_error(filename, size);
+		utilfdt_unmap(blob);
+		return -1;
+	}
+	buf = xmalloc(size);
+	err = fdt_index_build(blob, &index, buf, size);
+	if (err) {
+		report_error(filename, err);
+		free(buf);
+		utilfdt_unmap(blob);
+		return -1;
+	}
+
+	f = strcmp(script, "-") ? fopen(script, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "Couldn't open script '%s': %s\n", script,
+			strerror(errno));
+		free(buf);
+		utilfdt_unmap(blob);
+		return -1;
+	}
+
+	while (getline(&line, &line_size, f) != -1) {
+		lineno++;
+		num_words = util_split_words(line, &words);
+		if (!num_words) {
+			free(words);
+			words = NULL;
+			continue;
+		}
+		if (num_words < 0) {
+			/* util_split_words() has freed the words already */
+			fprintf(stderr, "%s:%d: unterminated quote\n", script,
+				lineno);
+			words = NULL;
+			err = -1;
+		} else if (num_words != args_per_step) {
+			fprintf(stderr, "%s:%d: expected %s\n", script, lineno,
+				args_per_step == 1 ? "<node>" :
+				"<node> <property>");
+			err = -1;
+		} else {
+			node = fdt_index_path_offset(blob, &index, words[0]);
+			if (node >= 0) {
+				err = show_data_for_item(blob, disp, node,
+						num_words > 1 ? words[1] : NULL);
+			} else if (disp->default_val) {
+				show_line(disp, disp->default_val);
+				err = 0;
+			} else {
+				report_error(words[0], node);
+				err = -1;
+			}
+		}
+		if (err) {
+			putchar(disp->term);
+			ret = -1;
+		}
+		free(words);
+		words = NULL;
+	}
+	if (f != stdin)
+		fclose(f);
+	free(line);
+	free(buf);
+	utilfdt_unmap(blob);
+
+	return ret;
+}
+
 /* Usage related data. */
 static const char usage_synopsis[] =
 	"read values from device tree\n"
 	"	fdtget <options> <dt file> [<node> <property>]...\n"
 	"	fdtget -p <options> <dt file> [<node> ]...\n"
+	"	fdtget -b <script> <options> <dt file>\n"
 	"\n"
 	"Each value is printed on a new line.\n"
+	"Each line of a batch script holds a node and property (or just a node\n"
+	"with -p or -l).\n"
 	USAGE_TYPE_MSG;
-static const char usage_short_opts[] = "t:pld:" USAGE_COMMON_SHORT_OPTS;
+static const char usage_short_opts[] = "t:pld:b:z" USAGE_COMMON_SHORT_OPTS;
 static struct option const usage_long_opts[] = {
 	{"type",              a_argument, NULL, 't'},
 	{"properties",       no_argument, NULL, 'p'},
 	{"list",             no_argument, NULL, 'l'},
 	{"default",           a_argument, NULL, 'd'},
+	{"batch",             a_argument, NULL, 'b'},
+	{"null",             no_argument, NULL, 'z'},
 	USAGE_COMMON_LONG_OPTS,
 };
 static const char * const usage_opts_help[] = {
@@ -298,6 +423,8 @@ static const char * const usage_opts_help[] = {
 	"List properties for each node",
 	"List subnodes for each node",
 	"Default value to display when the property is missing",
+	"Read queries from a script ('-' for stdin), reading the tree once",
+	"End each value with a NUL character instead of a newline",
 	USAGE_COMMON_OPTS_HELP
 };
 
@@ -305,6 +432,7 @@ int main(int argc, char *argv[])
 {
 	int opt;
 	char *filename = NULL;
+	char *script = NULL;
 	struct display_info disp;
 	int args_per_step = 2;
 
@@ -312,6 +440,7 @@ int main(int argc, char *argv[])
 	memset(&disp, '\0', sizeof(disp));
 	disp.size = -1;
 	disp.mode = MODE_SHOW_VALUE;
+	disp.term = '\n';
 	while ((opt = util_getopt_long()) != EOF) {
 		switch (opt) {
 		case_USAGE_COMMON_FLAGS
@@ -335,6 +464,14 @@ int main(int argc, char *argv[])
 		case 'd':
 			disp.default_val = optarg;
 			break;
+
+		case 'b':
+			script = optarg;
+			break;
+
+		case 'z':
+			disp.term = '\0';
+			break;
 		}
 	}
 
@@ -346,6 +483,14 @@ int main(int argc, char *argv[])
 	argv += optind;
 	argc -= optind;
 
+	if (script) {
+		if (argc)
+			usage("unexpected arguments in batch mode");
+		if (do_fdtget_batch(&disp, filename, script, args_per_step))
+			return 1;
+		return 0;
+	}
+
 	/* Allow no arguments, and silently succeed */
 	if (!argc)
 		return 0;
@@ -657,7 +657,7 @@ static int do_fdtgrep(struct display_info *disp, const char *filename)
 	char *blob;
 	int i, ret;
 
-	blob = utilfdt_read(filename);
+	blob = utilfdt_map(filename, NULL);
 	if (!blob)
 		return -1;
 	ret = fdt_check_header(blob);
@@ -753,7 +753,7 @@ static int do_fdtgrep(struct display_info *disp, const char *filename)
 		free(fdt);
 	}
 err:
-	free(blob);
+	utilfdt_unmap(blob);
 	free(region);
 
 	return ret;
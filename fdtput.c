@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -217,9 +218,13 @@ static int create_paths(char **blob, const char *in_path)
 		node = fdt_subnode_offset_namelen(*blob, offset, path,
 				sep - path);
 		if (node == -FDT_ERR_NOTFOUND) {
-			*blob = realloc_node(*blob, path);
 			node = fdt_add_subnode_namelen(*blob, offset, path,
 						       sep - path);
+			if (node == -FDT_ERR_NOSPACE) {
+				*blob = realloc_node(*blob, path);
+				node = fdt_add_subnode_namelen(*blob, offset,
+						path, sep - path);
+			}
 		}
 		if (node < 0) {
 			report_error(path, sep - path, node);
@@ -243,7 +248,7 @@ static int create_paths(char **blob, const char *in_path)
  */
 static int create_node(char **blob, const char *node_name)
 {
-	int node = 0;
+	int parent = 0, node;
 	char *p;
 
 	p = strrchr(node_name, '/');
@@ -253,17 +258,19 @@ static int create_node(char **blob, const char *node_name)
 	}
 	*p = '\0';
 
-	*blob = realloc_node(*blob, p + 1);
-
 	if (p > node_name) {
-		node = fdt_path_offset(*blob, node_name);
-		if (node < 0) {
-			report_error(node_name, -1, node);
+		parent = fdt_path_offset(*blob, node_name);
+		if (parent < 0) {
+			report_error(node_name, -1, parent);
 			return -1;
 		}
 	}
 
-	node = fdt_add_subnode(*blob, node, p + 1);
+	node = fdt_add_subnode(*blob, parent, p + 1);
+	if (node == -FDT_ERR_NOSPACE) {
+		*blob = realloc_node(*blob, p + 1);
+		node = fdt_add_subnode(*blob, parent, p + 1);
+	}
 	if (node < 0) {
 		report_error(p + 1, -1, node);
 		return -1;
@@ -325,18 +332,22 @@ static int delete_node(char *blob, const char *node_name)
 	return 0;
 }
 
-static int do_fdtput(struct display_info *disp, const char *filename,
-		    char **arg, int arg_count)
+/**
+ * Perform an operation on the fdt.
+ *
+ * @param disp		Display information / options
+ * @param blob		FDT blob to write into, updated if it is enlarged
+ * @param arg		List of arguments from command line
+ * @param arg_count	Number of arguments
+ * @return 0 on success, or -1 on failure
+ */
+static int do_oper(struct display_info *disp, char **blob, char **arg,
+		   int arg_count)
 {
 	char *value;
-	char *blob;
 	char *node;
 	int len, ret = 0;
 
-	blob = utilfdt_read(filename);
-	if (!blob)
-		return -1;
-
 	switch (disp->oper) {
 	case OPER_WRITE_PROP:
 		/*
@@ -344,30 +355,307 @@ static int do_fdtput(struct display_info *disp, const char *filename,
 		 * store them into the property.
 		 */
 		assert(arg_count >= 2);
-		if (disp->auto_path && create_paths(&blob, *arg))
+		if (disp->auto_path && create_paths(blob, *arg))
 			return -1;
 		if (encode_value(disp, arg + 2, arg_count - 2, &value, &len) ||
-			store_key_value(&blob, *arg, arg[1], value, len))
+			store_key_value(blob, *arg, arg[1], value, len))
 			ret = -1;
+		free(value);
 		break;
 	case OPER_CREATE_NODE:
 		for (; ret >= 0 && arg_count--; arg++) {
 			if (disp->auto_path)
-				ret = create_paths(&blob, *arg);
+				ret = create_paths(blob, *arg);
 			else
-				ret = create_node(&blob, *arg);
+				ret = create_node(blob, *arg);
 		}
 		break;
 	case OPER_REMOVE_NODE:
 		for (; ret >= 0 && arg_count--; arg++)
-			ret = delete_node(blob, *arg);
+			ret = delete_node(*blob, *arg);
 		break;
 	case OPER_DELETE_PROP:
 		node = *arg;
 		for (arg++; ret >= 0 && arg_count-- > 1; arg++)
-			ret = delete_prop(blob, node, *arg);
+			ret = delete_prop(*blob, node, *arg);
+		break;
+	}
+
+	return ret;
+}
+
+static int do_fdtput(struct display_info *disp, const char *filename,
+		    char **arg, int arg_count)
+{
+	char *blob;
+	int ret;
+
+	blob = utilfdt_read(filename);
+	if (!blob)
+		return -1;
+
+	ret = do_oper(disp, &blob, arg, arg_count);
+	if (ret >= 0) {
+		fdt_pack(blob);
+		ret = utilfdt_write(filename, blob);
+	}
+
+	free(blob);
+	return ret;
+}
+
+/* A command read from a batch script */
+struct batch_cmd {
+	struct display_info disp;	/* options for this command */
+	char **arg;			/* arguments after the options */
+	int arg_count;			/* number of arguments */
+	int line;			/* line number in the script */
+};
+
+/**
+ * Decode the options at the start of a command in a batch script.
+ *
+ * These are the same as on the command line: -c, -r, -d, -p, -v and
+ * -t <type>, which may be combined as in '-cp' or '-ts'.
+ *
+ * @param disp		Display information / options to update
+ * @param arg		List of words in the command
+ * @param arg_count	Number of words
+ * @return number of words used, or -1 on error
+ */
+static int decode_batch_opts(struct display_info *disp, char **arg,
+			     int arg_count)
+{
+	const char *p;
+	int i;
+
+	for (i = 0; i < arg_count && arg[i][0] == '-' && arg[i][1]; i++) {
+		for (p = arg[i] + 1; *p; p++) {
+			switch (*p) {
+			case 'c':
+				disp->oper = OPER_CREATE_NODE;
+				break;
+			case 'r':
+				disp->oper = OPER_REMOVE_NODE;
+				break;
+			case 'd':
+				disp->oper = OPER_DELETE_PROP;
+				break;
+			case 'p':
+				disp->auto_path = 1;
+				break;
+			case 'v':
+				disp->verbose = 1;
+				break;
+			case 't':
+				if (!p[1]) {
+					if (++i == arg_count)
+						return -1;
+					p = arg[i];
+				} else {
+					p++;
+				}
+				if (utilfdt_decode_type(p, &disp->type,
+							&disp->size))
+					return -1;
+				p += strlen(p) - 1;
+				break;
+			default:
+				return -1;
+			}
+		}
+	}
+
+	return i;
+}
+
+/* Size of the nodes which create_paths() might add for a path */
+static int paths_growth(const char *path)
+{
+	const char *sep;
+	int delta = 0;
+
+	for (; *path; path = sep) {
+		while (*path == '/')
+			path++;
+		sep = strchr(path, '/');
+		if (!sep)
+			sep = path + strlen(path);
+		if (sep > path)
+			delta += sizeof(struct fdt_node_header)
+				+ ALIGN(sep - path + 1) + FDT_TAGSIZE;
+	}
+
+	return delta;
+}
+
+/**
+ * Work out the most that a command could enlarge the fdt by.
+ *
+ * @param disp		Display information / options
+ * @param arg		List of arguments
+ * @param arg_count	Number of arguments
+ * @return number of bytes
+ */
+static int oper_growth(struct display_info *disp, char **arg, int arg_count)
+{
+	int delta = 0, len = 0;
+	int i;
+
+	switch (disp->oper) {
+	case OPER_WRITE_PROP:
+		for (i = 2; i < arg_count; i++)
+			len += disp->type == 's' ? strlen(arg[i]) + 1 :
+				disp->size == -1 ? 4 : disp->size;
+		delta = sizeof(struct fdt_property) + strlen(arg[1]) + 1
+			+ ALIGN(len);
+		if (disp->auto_path)
+			delta += paths_growth(*arg);
+		break;
+	case OPER_CREATE_NODE:
+		for (i = 0; i < arg_count; i++)
+			delta += paths_growth(arg[i]);
+		break;
+	default:
 		break;
 	}
+
+	return delta;
+}
+
+/**
+ * Check that a command has the arguments its operation needs.
+ *
+ * @return NULL if ok, else an error message
+ */
+static const char *check_args(struct display_info *disp, int arg_count)
+{
+	if (disp->oper == OPER_WRITE_PROP) {
+		if (arg_count < 1)
+			return "missing node";
+		if (arg_count < 2)
+			return "missing property";
+	}
+
+	if (disp->oper == OPER_DELETE_PROP)
+		if (arg_count < 1)
+			return "missing node";
+
+	return NULL;
+}
+
+/**
+ * Read a batch script, with one command per line.
+ *
+ * @param disp		Default options for each command
+ * @param script	Filename of script, or "-" for stdin
+ * @param cmdsp		Returns list of commands
+ * @return number of commands, or -1 on error
+ */
+static int read_batch(struct display_info *disp, const char *script,
+		      struct batch_cmd **cmdsp)
+{
+	struct batch_cmd *cmds = NULL, *cmd;
+	int count = 0, size = 0, lineno = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	const char *msg;
+	char **words;
+	int num_words, used;
+	FILE *f;
+
+	f = strcmp(script, "-") ? fopen(script, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "Couldn't open script '%s': %s\n", script,
+			strerror(errno));
+		return -1;
+	}
+
+	while (getline(&line, &line_size, f) != -1) {
+		lineno++;
+		num_words = util_split_words(line, &words);
+		if (num_words < 0) {
+			msg = "unterminated quote";
+			goto err;
+		}
+		if (!num_words)
+			continue;
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			cmds = xrealloc(cmds, size * sizeof(*cmds));
+		}
+		cmd = &cmds[count++];
+		cmd->disp = *disp;
+		cmd->line = lineno;
+		used = decode_batch_opts(&cmd->disp, words, num_words);
+		if (used < 0) {
+			msg = "invalid option";
+			goto err;
+		}
+		cmd->arg = words + used;
+		cmd->arg_count = num_words - used;
+		msg = check_args(&cmd->disp, cmd->arg_count);
+		if (msg)
+			goto err;
+
+		/* The words point into the line, so keep it */
+		line = NULL;
+		line_size = 0;
+	}
+	if (f != stdin)
+		fclose(f);
+	free(line);
+
+	*cmdsp = cmds;
+	return count;
+
+err:
+	fprintf(stderr, "%s:%d: %s\n", script, lineno, msg);
+	if (f != stdin)
+		fclose(f);
+	return -1;
+}
+
+/**
+ * Run a batch script against an fdt.
+ *
+ * The fdt is read once, enlarged once to hold everything the commands
+ * might add, then written once after all commands succeed. Nothing is
+ * written if any command fails.
+ *
+ * @param disp		Default options for each command
+ * @param filename	Filename of fdt
+ * @param script	Filename of script
+ * @return 0 on success, or -1 on failure
+ */
+static int do_fdtput_batch(struct display_info *disp, const char *filename,
+			   const char *script)
+{
+	struct batch_cmd *cmds;
+	int count, delta, i;
+	char *blob;
+	int ret = 0;
+
+	count = read_batch(disp, script, &cmds);
+	if (count < 0)
+		return -1;
+
+	blob = utilfdt_read(filename);
+	if (!blob)
+		return -1;
+
+	for (i = 0, delta = 0; i < count; i++)
+		delta += oper_growth(&cmds[i].disp, cmds[i].arg,
+				     cmds[i].arg_count);
+	blob = _realloc_fdt(blob, delta);
+
+	for (i = 0; ret >= 0 && i < count; i++) {
+		ret = do_oper(&cmds[i].disp, &blob, cmds[i].arg,
+			      cmds[i].arg_count);
+		if (ret < 0)
+			fprintf(stderr, "%s:%d: command failed\n", script,
+				cmds[i].line);
+	}
 	if (ret >= 0) {
 		fdt_pack(blob);
 		ret = utilfdt_write(filename, blob);
@@ -384,10 +672,13 @@ static const char usage_synopsis[] =
 	"	fdtput -c <options> <dt file> [<node>...]\n"
 	"	fdtput -r <options> <dt file> [<node>...]\n"
 	"	fdtput -d <options> <dt file> <node> [<property>...]\n"
+	"	fdtput -b <script> <options> <dt file>\n"
 	"\n"
 	"The command line arguments are joined together into a single value.\n"
+	"Each line of a batch script holds the options and arguments which\n"
+	"would follow <dt file> on the command line, for one command.\n"
 	USAGE_TYPE_MSG;
-static const char usage_short_opts[] = "crdpt:v" USAGE_COMMON_SHORT_OPTS;
+static const char usage_short_opts[] = "crdpt:vb:" USAGE_COMMON_SHORT_OPTS;
 static struct option const usage_long_opts[] = {
 	{"create",           no_argument, NULL, 'c'},
 	{"remove",	     no_argument, NULL, 'r'},
@@ -395,6 +686,7 @@ static struct option const usage_long_opts[] = {
 	{"auto-path",        no_argument, NULL, 'p'},
 	{"type",              a_argument, NULL, 't'},
 	{"verbose",          no_argument, NULL, 'v'},
+	{"batch",             a_argument, NULL, 'b'},
 	USAGE_COMMON_LONG_OPTS,
 };
 static const char * const usage_opts_help[] = {
@@ -404,6 +696,7 @@ static const char * const usage_opts_help[] = {
 	"Automatically create nodes as needed for the node path",
 	"Type of data",
 	"Display each value decoded from command line",
+	"Read commands from a script ('-' for stdin), writing the tree once",
 	USAGE_COMMON_OPTS_HELP
 };
 
@@ -412,6 +705,8 @@ int main(int argc, char *argv[])
 	int opt;
 	struct display_info disp;
 	char *filename = NULL;
+	char *script = NULL;
+	const char *msg;
 
 	memset(&disp, '\0', sizeof(disp));
 	disp.size = -1;
@@ -447,6 +742,9 @@ int main(int argc, char *argv[])
 		case 'v':
 			disp.verbose = 1;
 			break;
+		case 'b':
+			script = optarg;
+			break;
 		}
 	}
 
@@ -458,16 +756,17 @@ int main(int argc, char *argv[])
 	argv += optind;
 	argc -= optind;
 
-	if (disp.oper == OPER_WRITE_PROP) {
-		if (argc < 1)
-			usage("missing node");
-		if (argc < 2)
-			usage("missing property");
+	if (script) {
+		if (argc)
+			usage("unexpected arguments in batch mode");
+		if (do_fdtput_batch(&disp, filename, script))
+			return 1;
+		return 0;
 	}
 
-	if (disp.oper == OPER_DELETE_PROP)
-		if (argc < 1)
-			usage("missing node");
+	msg = check_args(&disp, argc);
+	if (msg)
+		usage(msg);
 
 	if (do_fdtput(&disp, filename, argv, argc))
 		return 1;
@@ -18,6 +18,8 @@
  *                                                                   USA
  */
 
+#include <pthread.h>
+
 #include "dtc.h"
 #include "srcpos.h"
 
@@ -57,36 +59,110 @@ struct emitter {
 	void (*property)(void *, struct label *labels);
 };
 
+/*
+ * dt_to_blob() flattens the tree twice: first with size_emitter, which
+ * only counts the bytes that the structure block will take up (and fills
+ * in the string table), then with bin_emitter, which writes the block
+ * straight into the blob, allocated at its final size.
+ */
+static void size_emit_cell(void *e, cell_t val)
+{
+	int *size = e;
+
+	*size += sizeof(cell_t);
+}
+
+static void size_emit_string(void *e, char *str, int len)
+{
+	int *size = e;
+
+	if (len == 0)
+		len = strlen(str);
+
+	*size += len + 1;
+}
+
+static void size_emit_align(void *e, int a)
+{
+	int *size = e;
+
+	*size = ALIGN(*size, a);
+}
+
+static void size_emit_data(void *e, struct data d)
+{
+	int *size = e;
+
+	*size += d.len;
+}
+
+static void size_emit_beginnode(void *e, struct label *labels)
+{
+	size_emit_cell(e, FDT_BEGIN_NODE);
+}
+
+static void size_emit_endnode(void *e, struct label *labels)
+{
+	size_emit_cell(e, FDT_END_NODE);
+}
+
+static void size_emit_property(void *e, struct label *labels)
+{
+	size_emit_cell(e, FDT_PROP);
+}
+
+static struct emitter size_emitter = {
+	.cell = size_emit_cell,
+	.string = size_emit_string,
+	.align = size_emit_align,
+	.data = size_emit_data,
+	.beginnode = size_emit_beginnode,
+	.endnode = size_emit_endnode,
+	.property = size_emit_property,
+};
+
+/* The structure block, with room for all of it */
+struct flatbuf {
+	char *val;
+	int len;	/* bytes written so far */
+};
+
 static void bin_emit_cell(void *e, cell_t val)
 {
-	struct data *dtbuf = e;
+	struct flatbuf *dtbuf = e;
+	fdt32_t beval = cpu_to_fdt32(val);
 
-	*dtbuf = data_append_cell(*dtbuf, val);
+	memcpy(dtbuf->val + dtbuf->len, &beval, sizeof(beval));
+	dtbuf->len += sizeof(beval);
 }
 
 static void bin_emit_string(void *e, char *str, int len)
 {
-	struct data *dtbuf = e;
+	struct flatbuf *dtbuf = e;
 
 	if (len == 0)
 		len = strlen(str);
 
-	*dtbuf = data_append_data(*dtbuf, str, len);
-	*dtbuf = data_append_byte(*dtbuf, '\0');
+	memcpy(dtbuf->val + dtbuf->len, str, len);
+	dtbuf->val[dtbuf->len + len] = '\0';
+	dtbuf->len += len + 1;
 }
 
 static void bin_emit_align(void *e, int a)
 {
-	struct data *dtbuf = e;
+	struct flatbuf *dtbuf = e;
+	int newlen = ALIGN(dtbuf->len, a);
 
-	*dtbuf = data_append_align(*dtbuf, a);
+	memset(dtbuf->val + dtbuf->len, 0, newlen - dtbuf->len);
+	dtbuf->len = newlen;
 }
 
 static void bin_emit_data(void *e, struct data d)
 {
-	struct data *dtbuf = e;
+	struct flatbuf *dtbuf = e;
 
-	*dtbuf = data_append_data(*dtbuf, d.val, d.len);
+	memcpy(dtbuf->val + dtbuf->len, d.val, d.len);
+	dtbuf->len += d.len;
 }
 
 static void bin_emit_beginnode(void *e, struct label *labels)
@@ -240,32 +316,101 @@ static struct emitter asm_emitter = {
 	.property = asm_emit_property,
 };
 
-static int stringtable_insert(struct data *d, const char *str)
+/*
+ * The string table. Every suffix of every string in the table is hashed,
+ * so that a new name which is the tail of an existing one (e.g. "cells"
+ * after "#address-cells") shares its storage, as it always has, without
+ * needing a linear search of the table for each property.
+ */
+struct stringtable {
+	struct data data;	/* the strings themselves */
+	int *slot;		/* offset of each hashed suffix, -1 if empty */
+	int num_slots;		/* always a power of two */
+	int count;		/* number of slots in use */
+};
+
+/*
+ * Find the slot for a string: either the one holding it, or the empty
+ * slot where it should go
+ */
+static int *stringtable_slot(struct stringtable *st, const char *str, int len)
 {
-	int i;
+	unsigned int i = util_hash(str, len);
+	int *slot;
 
-	/* FIXME: do this more efficiently? */
+	for (;; i++) {
+		slot = &st->slot[i & (st->num_slots - 1)];
+		if ((*slot < 0) || streq(st->data.val + *slot, str))
+			return slot;
+	}
+}
 
-	for (i = 0; i < d->len; i++) {
-		if (streq(str, d->val + i))
-			return i;
+static void stringtable_grow(struct stringtable *st)
+{
+	int *old = st->slot;
+	int old_slots = st->num_slots;
+	int i, off;
+
+	st->num_slots = old_slots ? old_slots * 2 : 256;
+	st->slot = xmalloc(st->num_slots * sizeof(*st->slot));
+	for (i = 0; i < st->num_slots; i++)
+		st->slot[i] = -1;
+
+	for (i = 0; i < old_slots; i++) {
+		off = old[i];
+		if (off >= 0)
+			*stringtable_slot(st, st->data.val + off,
+					  strlen(st->data.val + off)) = off;
 	}
+	free(old);
+}
 
-	*d = data_append_data(*d, str, strlen(str)+1);
-	return i;
+static int stringtable_insert(struct stringtable *st, const char *str)
+{
+	int len = strlen(str);
+	int *slot;
+	int off, i;
+
+	if (st->num_slots) {
+		slot = stringtable_slot(st, str, len);
+		if (*slot >= 0)
+			return *slot;
+	}
+
+	off = st->data.len;
+	st->data = data_append_data(st->data, str, len + 1);
+
+	/*
+	 * Hash each suffix, keeping any earlier (and so lower) offset which
+	 * was already there
+	 */
+	for (i = 0; i <= len; i++) {
+		if ((st->count + 1) * 2 > st->num_slots)
+			stringtable_grow(st);
+		slot = stringtable_slot(st, str + i, len - i);
+		if (*slot < 0) {
+			*slot = off + i;
+			st->count++;
+		}
+	}
+
+	return off;
 }
 
-static void flatten_tree(struct node *tree, struct emitter *emit,
-			 void *etarget, struct data *strbuf,
-			 struct version_info *vi)
+static void stringtable_free(struct stringtable *st)
+{
+	free(st->slot);
+	data_free(st->data);
+}
+
+/* Flatten a node's name and properties, but not its subnodes */
+static void flatten_node_start(struct node *tree, struct emitter *emit,
+			       void *etarget, struct stringtable *strtab,
+			       struct version_info *vi)
 {
 	struct property *prop;
-	struct node *child;
 	bool seen_name_prop = false;
 
-	if (tree->deleted)
-		return;
-
 	emit->beginnode(etarget, tree->labels);
 
 	if (vi->flags & FTF_FULLPATH)
@@ -281,7 +426,7 @@ static void flatten_tree(struct node *tree, struct emitter *emit,
 		if (streq(prop->name, "name"))
 			seen_name_prop = true;
 
-		nameoff = stringtable_insert(strbuf, prop->name);
+		nameoff = stringtable_insert(strtab, prop->name);
 
 		emit->property(etarget, prop->labels);
 		emit->cell(etarget, prop->val.len);
@@ -297,7 +442,7 @@ static void flatten_tree(struct node *tree, struct emitter *emit,
 	if ((vi->flags & FTF_NAMEPROPS) && !seen_name_prop) {
 		emit->property(etarget, NULL);
 		emit->cell(etarget, tree->basenamelen+1);
-		emit->cell(etarget, stringtable_insert(strbuf, "name"));
+		emit->cell(etarget, stringtable_insert(strtab, "name"));
 
 		if ((vi->flags & FTF_VARALIGN) && ((tree->basenamelen+1) >= 8))
 			emit->align(etarget, 8);
@@ -305,33 +450,222 @@ static void flatten_tree(struct node *tree, struct emitter *emit,
 		emit->string(etarget, tree->name, tree->basenamelen);
 		emit->align(etarget, sizeof(cell_t));
 	}
+}
+
+static void flatten_tree(struct node *tree, struct emitter *emit,
+			 void *etarget, struct stringtable *strtab,
+			 struct version_info *vi)
+{
+	struct node *child;
+
+	if (tree->deleted)
+		return;
+
+	flatten_node_start(tree, emit, etarget, strtab, vi);
 
 	for_each_child(tree, child) {
-		flatten_tree(child, emit, etarget, strbuf, vi);
+		flatten_tree(child, emit, etarget, strtab, vi);
 	}
 
 	emit->endnode(etarget, tree->labels);
 }
 
-static struct data flatten_reserve_list(struct reserve_info *reservelist,
-				 struct version_info *vi)
+/*
+ * With -j, the root's subtrees are flattened in parallel. They are shared
+ * out in order between the threads, each of which first works out the
+ * size of its share, using a string table of its own. Adding the strings
+ * from each share's table to the blob's, in order, then gives exactly the
+ * table that flattening serially would have, since each share's table
+ * holds the names which that share used first, in the order it used them.
+ * With the blob allocated, each thread writes its share straight into
+ * place, and then fixes up the name offsets of its properties to refer to
+ * the blob's string table instead of its own.
+ *
+ * Before version 16, some values are aligned to 8 bytes from the start of
+ * the structure block, so a share's layout depends on where it starts;
+ * those blobs are always flattened serially.
+ */
+struct flat_job {
+	pthread_t thread;
+	bool started;
+	struct node *first;	/* first subtree of the root in this share */
+	int count;		/* number of subtrees */
+	struct version_info *vi;
+	struct stringtable strtab;	/* names used in this share */
+	int size;		/* of this share of the structure block */
+	char *buf;		/* where the share goes in the blob */
+	struct stringtable *blob_strtab;
+};
+
+/* Share the root's subtrees out into jobs, returning how many */
+static int plan_flat_jobs(struct node *tree, struct version_info *vi,
+			  struct flat_job **jobp)
+{
+	struct flat_job *job;
+	struct node *child;
+	int i, j, n = 0, njobs;
+
+	for_each_child_withdel(tree, child)
+		n++;
+
+	njobs = (jobs < n) ? jobs : n;
+	if ((njobs < 2) || (vi->flags & FTF_VARALIGN))
+		return 0;
+
+	job = xmalloc(njobs * sizeof(*job));
+	memset(job, 0, njobs * sizeof(*job));
+	child = tree->children;
+	for (i = 0; i < njobs; i++) {
+		job[i].first = child;
+		job[i].count = (i + 1) * n / njobs - i * n / njobs;
+		job[i].vi = vi;
+		for (j = 0; j < job[i].count; j++)
+			child = child->next_sibling;
+	}
+	*jobp = job;
+
+	return njobs;
+}
+
+/* Run each job, the first here; any thread we can't start runs here too */
+static void run_flat_jobs(struct flat_job *job, int njobs,
+			  void *(*fn)(void *))
 {
-	struct reserve_info *re;
-	struct data d = empty_data;
-	static struct fdt_reserve_entry null_re = {0,0};
-	int    j;
+	int i;
 
-	for (re = reservelist; re; re = re->next) {
-		d = data_append_re(d, &re->re);
+	for (i = 1; i < njobs; i++)
+		job[i].started = !pthread_create(&job[i].thread, NULL, fn,
+						 &job[i]);
+	fn(&job[0]);
+	for (i = 1; i < njobs; i++) {
+		if (job[i].started)
+			pthread_join(job[i].thread, NULL);
+		else
+			fn(&job[i]);
 	}
-	/*
-	 * Add additional reserved slots if the user asked for them.
-	 */
-	for (j = 0; j < reservenum; j++) {
-		d = data_append_re(d, &null_re);
+}
+
+static void *flat_size_fn(void *arg)
+{
+	struct flat_job *job = arg;
+	struct node *child = job->first;
+	int i;
+
+	for (i = 0; i < job->count; i++, child = child->next_sibling)
+		flatten_tree(child, &size_emitter, &job->size, &job->strtab,
+			     job->vi);
+
+	return NULL;
+}
+
+/* Make the name offsets in a job's share refer to the blob's strings */
+static void fixup_name_offsets(struct flat_job *job)
+{
+	char *p = job->buf, *end = job->buf + job->size;
+	fdt32_t *cell;
+	const char *name;
+	int *slot;
+
+	while (p < end) {
+		cell = (fdt32_t *)p;
+		p += sizeof(cell_t);
+		switch (fdt32_to_cpu(cell[0])) {
+		case FDT_BEGIN_NODE:
+			p += ALIGN(strlen(p) + 1, sizeof(cell_t));
+			break;
+
+		case FDT_PROP:
+			name = job->strtab.data.val + fdt32_to_cpu(cell[2]);
+			slot = stringtable_slot(job->blob_strtab, name,
+						strlen(name));
+			assert(*slot >= 0);
+			cell[2] = cpu_to_fdt32(*slot);
+			p += 2 * sizeof(cell_t) +
+				ALIGN(fdt32_to_cpu(cell[1]), sizeof(cell_t));
+			break;
+
+		default:
+			assert(fdt32_to_cpu(cell[0]) == FDT_END_NODE);
+		}
 	}
+}
 
-	return d;
+static void *flat_write_fn(void *arg)
+{
+	struct flat_job *job = arg;
+	struct node *child = job->first;
+	struct flatbuf dtbuf;
+	int i;
+
+	dtbuf.val = job->buf;
+	dtbuf.len = 0;
+	for (i = 0; i < job->count; i++, child = child->next_sibling)
+		flatten_tree(child, &bin_emitter, &dtbuf, &job->strtab,
+			     job->vi);
+	assert(dtbuf.len == job->size);
+
+	fixup_name_offsets(job);
+
+	return NULL;
+}
+
+/* Work out the size of a tree's structure block, flattening in parallel */
+static int size_tree_parallel(struct node *tree, struct stringtable *strtab,
+			      struct version_info *vi, struct flat_job *job,
+			      int njobs)
+{
+	const char *p, *end;
+	int size = 0;
+	int i;
+
+	flatten_node_start(tree, &size_emitter, &size, strtab, vi);
+	run_flat_jobs(job, njobs, flat_size_fn);
+	for (i = 0; i < njobs; i++) {
+		size += job[i].size;
+		p = job[i].strtab.data.val;
+		end = p + job[i].strtab.data.len;
+		for (; p < end; p += strlen(p) + 1)
+			stringtable_insert(strtab, p);
+	}
+	size_emit_endnode(&size, tree->labels);
+
+	return size;
+}
+
+static void write_tree_parallel(struct node *tree, struct flatbuf *dtbuf,
+				struct stringtable *strtab,
+				struct version_info *vi, struct flat_job *job,
+				int njobs)
+{
+	int i;
+
+	flatten_node_start(tree, &bin_emitter, dtbuf, strtab, vi);
+	for (i = 0; i < njobs; i++) {
+		job[i].buf = dtbuf->val + dtbuf->len;
+		job[i].blob_strtab = strtab;
+		dtbuf->len += job[i].size;
+	}
+	run_flat_jobs(job, njobs, flat_write_fn);
+	bin_emit_endnode(dtbuf, tree->labels);
+
+	for (i = 0; i < njobs; i++)
+		stringtable_free(&job[i].strtab);
+	free(job);
+}
+
+/* Write the entries of the reserve map, which alloc_blob() cleared */
+static void flatten_reserve_list(char *buf,
+				 struct reserve_info *reservelist)
+{
+	struct reserve_info *re;
+	struct fdt_reserve_entry bere;
+
+	for (re = reservelist; re; re = re->next) {
+		bere.address = cpu_to_fdt64(re->re.address);
+		bere.size = cpu_to_fdt64(re->re.size);
+		memcpy(buf, &bere, sizeof(bere));
+		buf += sizeof(bere);
+	}
 }
 
 static void make_fdt_header(struct fdt_header *fdt,
@@ -366,72 +700,90 @@ static void make_fdt_header(struct fdt_header *fdt,
 		fdt->size_dt_struct = cpu_to_fdt32(dtsize);
 }
 
-void dt_to_blob(FILE *f, struct boot_info *bi, int version)
+static struct version_info *find_version(int version)
 {
-	struct version_info *vi = NULL;
 	int i;
-	struct data blob       = empty_data;
-	struct data reservebuf = empty_data;
-	struct data dtbuf      = empty_data;
-	struct data strbuf     = empty_data;
-	struct fdt_header fdt;
-	int padlen = 0;
 
 	for (i = 0; i < ARRAY_SIZE(version_table); i++) {
 		if (version_table[i].version == version)
-			vi = &version_table[i];
+			return &version_table[i];
 	}
-	if (!vi)
-		die("Unknown device tree blob version %d\n", version);
+	die("Unknown device tree blob version %d\n", version);
+}
 
-	flatten_tree(bi->dt, &bin_emitter, &dtbuf, &strbuf, vi);
-	bin_emit_cell(&dtbuf, FDT_END);
+/*
+ * Work out the header of a blob with blocks of the given sizes, making
+ * room for any extra reserve map entries and padding the user asked for.
+ */
+static void make_blob_header(struct fdt_header *fdt,
+			     struct version_info *vi,
+			     int reservesize, int dtsize, int strsize,
+			     int boot_cpuid_phys)
+{
+	int padlen = 0;
 
-	reservebuf = flatten_reserve_list(bi->reservelist, vi);
+	/*
+	 * Add additional reserved slots if the user asked for them.
+	 */
+	reservesize += reservenum * sizeof(struct fdt_reserve_entry);
 
-	/* Make header */
-	make_fdt_header(&fdt, vi, reservebuf.len, dtbuf.len, strbuf.len,
-			bi->boot_cpuid_phys);
+	make_fdt_header(fdt, vi, reservesize, dtsize, strsize,
+			boot_cpuid_phys);
 
 	/*
 	 * If the user asked for more space than is used, adjust the totalsize.
 	 */
 	if (minsize > 0) {
-		padlen = minsize - fdt32_to_cpu(fdt.totalsize);
+		padlen = minsize - fdt32_to_cpu(fdt->totalsize);
 		if ((padlen < 0) && (quiet < 1))
 			fprintf(stderr,
 				"Warning: blob size %d >= minimum size %d\n",
-				fdt32_to_cpu(fdt.totalsize), minsize);
+				fdt32_to_cpu(fdt->totalsize), minsize);
 	}
 
 	if (padsize > 0)
 		padlen = padsize;
 
 	if (padlen > 0) {
-		int tsize = fdt32_to_cpu(fdt.totalsize);
+		int tsize = fdt32_to_cpu(fdt->totalsize);
 		tsize += padlen;
-		fdt.totalsize = cpu_to_fdt32(tsize);
+		fdt->totalsize = cpu_to_fdt32(tsize);
 	}
+}
 
-	/*
-	 * Assemble the blob: start with the header, add with alignment
-	 * the reserve buffer, add the reserve map terminating zeroes,
-	 * the device tree itself, and finally the strings.
-	 */
-	blob = data_append_data(blob, &fdt, vi->hdr_size);
-	blob = data_append_align(blob, 8);
-	blob = data_merge(blob, reservebuf);
-	blob = data_append_zeroes(blob, sizeof(struct fdt_reserve_entry));
-	blob = data_merge(blob, dtbuf);
-	blob = data_merge(blob, strbuf);
+/*
+ * Blobs are assembled in place: the header, padded to the reserve map's
+ * alignment, the reserve map, the device tree itself, the strings and
+ * then any padding. alloc_blob() allocates the whole blob and writes the
+ * header, with the reserve map cleared; the caller writes its entries and
+ * the structure block, and finish_blob() adds the rest.
+ */
+static char *alloc_blob(struct fdt_header *fdt, struct version_info *vi)
+{
+	char *blob = xmalloc(fdt32_to_cpu(fdt->totalsize));
 
-	/*
-	 * If the user asked for more space than is used, pad out the blob.
-	 */
-	if (padlen > 0)
-		blob = data_append_zeroes(blob, padlen);
+	memcpy(blob, fdt, vi->hdr_size);
+	memset(blob + vi->hdr_size, 0,
+	       fdt32_to_cpu(fdt->off_dt_struct) - vi->hdr_size);
+
+	return blob;
+}
+
+static void finish_blob(char *blob, const char *strings, int strsize)
+{
+	struct fdt_header *fdt = (struct fdt_header *)blob;
+	int totalsize = fdt32_to_cpu(fdt->totalsize);
+	char *strbuf = blob + fdt32_to_cpu(fdt->off_dt_strings);
 
-	if (fwrite(blob.val, blob.len, 1, f) != 1) {
+	memcpy(strbuf, strings, strsize);
+	memset(strbuf + strsize, 0, totalsize - (strbuf + strsize - blob));
+}
+
+void dt_write_blob(FILE *f, char *blob)
+{
+	struct fdt_header *fdt = (struct fdt_header *)blob;
+
+	if (fwrite(blob, fdt32_to_cpu(fdt->totalsize), 1, f) != 1) {
 		if (ferror(f))
 			die("Error writing device tree blob: %s\n",
 			    strerror(errno));
@@ -439,11 +791,53 @@ void dt_to_blob(FILE *f, struct boot_info *bi, int version)
 			die("Short write on device tree blob\n");
 	}
 
-	/*
-	 * data_merge() frees the right-hand element so only the blob
-	 * remains to be freed.
-	 */
-	data_free(blob);
+	free(blob);
+}
+
+void dt_to_blob(FILE *f, struct boot_info *bi, int version)
+{
+	struct version_info *vi;
+	struct reserve_info *re;
+	struct flatbuf dtbuf;
+	struct stringtable strtab = { 0 };
+	struct fdt_header fdt;
+	struct flat_job *job = NULL;
+	int reservesize = 0, dtsize = 0;
+	int njobs;
+	char *blob;
+
+	vi = find_version(version);
+
+	njobs = plan_flat_jobs(bi->dt, vi, &job);
+	if (njobs)
+		dtsize = size_tree_parallel(bi->dt, &strtab, vi, job, njobs);
+	else
+		flatten_tree(bi->dt, &size_emitter, &dtsize, &strtab, vi);
+	size_emit_cell(&dtsize, FDT_END);
+
+	for (re = bi->reservelist; re; re = re->next)
+		reservesize += sizeof(struct fdt_reserve_entry);
+
+	make_blob_header(&fdt, vi, reservesize, dtsize, strtab.data.len,
+			 bi->boot_cpuid_phys);
+
+	blob = alloc_blob(&fdt, vi);
+	flatten_reserve_list(blob + fdt32_to_cpu(fdt.off_mem_rsvmap),
+			     bi->reservelist);
+
+	dtbuf.val = blob + fdt32_to_cpu(fdt.off_dt_struct);
+	dtbuf.len = 0;
+	if (njobs)
+		write_tree_parallel(bi->dt, &dtbuf, &strtab, vi, job, njobs);
+	else
+		flatten_tree(bi->dt, &bin_emitter, &dtbuf, &strtab, vi);
+	bin_emit_cell(&dtbuf, FDT_END);
+	assert(dtbuf.len == dtsize);
+
+	finish_blob(blob, strtab.data.val, strtab.data.len);
+	dt_write_blob(f, blob);
+
+	stringtable_free(&strtab);
 }
 
 static void dump_stringtable_asm(FILE *f, struct data strbuf)
@@ -462,18 +856,13 @@ static void dump_stringtable_asm(FILE *f, struct data strbuf)
 
 void dt_to_asm(FILE *f, struct boot_info *bi, int version)
 {
-	struct version_info *vi = NULL;
+	struct version_info *vi;
 	int i;
-	struct data strbuf = empty_data;
+	struct stringtable strtab = { 0 };
 	struct reserve_info *re;
 	const char *symprefix = "dt";
 
-	for (i = 0; i < ARRAY_SIZE(version_table); i++) {
-		if (version_table[i].version == version)
-			vi = &version_table[i];
-	}
-	if (!vi)
-		die("Unknown device tree blob version %d\n", version);
+	vi = find_version(version);
 
 	fprintf(f, "/* autogenerated by dtc, do not edit */\n\n");
 
@@ -550,14 +939,14 @@ void dt_to_asm(FILE *f, struct boot_info *bi, int version)
 	fprintf(f, "\t.long\t0, 0\n\t.long\t0, 0\n");
 
 	emit_label(f, symprefix, "struct_start");
-	flatten_tree(bi->dt, &asm_emitter, f, &strbuf, vi);
+	flatten_tree(bi->dt, &asm_emitter, f, &strtab, vi);
 
 	fprintf(f, "\t/* FDT_END */\n");
 	asm_emit_cell(f, FDT_END);
 	emit_label(f, symprefix, "struct_end");
 
 	emit_label(f, symprefix, "strings_start");
-	dump_stringtable_asm(f, strbuf);
+	dump_stringtable_asm(f, strtab.data);
 	emit_label(f, symprefix, "strings_end");
 
 	emit_label(f, symprefix, "blob_end");
@@ -574,7 +963,7 @@ void dt_to_asm(FILE *f, struct boot_info *bi, int version)
 	}
 	emit_label(f, symprefix, "blob_abs_end");
 
-	data_free(strbuf);
+	stringtable_free(&strtab);
 }
 
 struct inbuf {
@@ -618,11 +1007,11 @@ static void flat_realign(struct inbuf *inb, int align)
 		die("Premature end of data parsing flat device tree\n");
 }
 
-static char *flat_read_string(struct inbuf *inb)
+static const char *flat_skip_string(struct inbuf *inb)
 {
 	int len = 0;
 	const char *p = inb->ptr;
-	char *str;
+	const char *str = inb->ptr;
 
 	do {
 		if (p >= inb->limit)
@@ -630,8 +1019,6 @@ static char *flat_read_string(struct inbuf *inb)
 		len++;
 	} while ((*p++) != '\0');
 
-	str = xstrdup(inb->ptr);
-
 	inb->ptr += len;
 
 	flat_realign(inb, sizeof(uint32_t));
@@ -639,6 +1026,16 @@ static char *flat_read_string(struct inbuf *inb)
 	return str;
 }
 
+static char *flat_read_string(struct inbuf *inb)
+{
+	return arena_strdup(flat_skip_string(inb));
+}
+
+/*
+ * Property values are not copied, but borrow from the blob, which is kept
+ * until the tree is finished with. They are copied when they grow, and
+ * the blob may be written to in place.
+ */
 static struct data flat_read_data(struct inbuf *inb, int len)
 {
 	struct data d = empty_data;
@@ -646,17 +1043,19 @@ static struct data flat_read_data(struct inbuf *inb, int len)
 	if (len == 0)
 		return empty_data;
 
-	d = data_grow_for(d, len);
-	d.len = len;
+	if ((inb->ptr + len) > inb->limit)
+		die("Premature end of data parsing flat device tree\n");
 
-	flat_read_chunk(inb, d.val, len);
+	d.val = inb->ptr;
+	d.len = len;
+	inb->ptr += len;
 
 	flat_realign(inb, sizeof(uint32_t));
 
 	return d;
 }
 
-static char *flat_read_stringtable(struct inbuf *inb, int offset)
+static const char *flat_check_stringtable(struct inbuf *inb, int offset)
 {
 	const char *p;
 
@@ -672,7 +1071,12 @@ static char *flat_read_stringtable(struct inbuf *inb, int offset)
 		p++;
 	}
 
-	return xstrdup(inb->base + offset);
+	return inb->base + offset;
+}
+
+static char *flat_read_stringtable(struct inbuf *inb, int offset)
+{
+	return arena_strdup(flat_check_stringtable(inb, offset));
 }
 
 static struct property *flat_read_property(struct inbuf *dtbuf,
@@ -737,7 +1141,7 @@ static char *nodename_from_path(const char *ppath, const char *cpath)
 	if (!streq(ppath, "/"))
 		plen++;
 
-	return xstrdup(cpath + plen);
+	return arena_strdup(cpath + plen);
 }
 
 static struct node *unflatten_tree(struct inbuf *dtbuf,
@@ -801,82 +1205,60 @@ static struct node *unflatten_tree(struct inbuf *dtbuf,
 }
 
 
-struct boot_info *dt_from_blob(const char *fname)
+char *dt_read_blob(const char *fname)
 {
 	FILE *f;
-	uint32_t magic, totalsize, version, size_dt, boot_cpuid_phys;
-	uint32_t off_dt, off_str, off_mem_rsvmap;
-	int rc;
+	uint32_t magic, totalsize;
+	int fd, err;
+	off_t len;
 	char *blob;
 	struct fdt_header *fdt;
-	char *p;
-	struct inbuf dtbuf, strbuf;
-	struct inbuf memresvbuf;
-	int sizeleft;
-	struct reserve_info *reservelist;
-	struct node *tree;
-	uint32_t val;
-	int flags = 0;
 
-	f = srcfile_relative_open(fname, NULL);
+	f = srcfile_relative_open(NULL, fname, NULL);
+	fd = dup(fileno(f));
+	if (fd < 0)
+		die("Error reading DT blob: %s\n", strerror(errno));
+	fclose(f);
 
-	rc = fread(&magic, sizeof(magic), 1, f);
-	if (ferror(f))
-		die("Error reading DT blob magic number: %s\n",
-		    strerror(errno));
-	if (rc < 1) {
-		if (feof(f))
-			die("EOF reading DT blob magic number\n");
-		else
-			die("Mysterious short read reading magic number\n");
-	}
+	/* Map the blob, so that the tree can borrow from it */
+	err = utilfdt_map_fd_err(fd, &blob, &len);
+	if (err)
+		die("Error reading DT blob: %s\n", strerror(err));
+	fdt = (struct fdt_header *)blob;
 
-	magic = fdt32_to_cpu(magic);
+	if (len < sizeof(fdt->magic))
+		die("EOF reading DT blob magic number\n");
+
+	magic = fdt32_to_cpu(fdt->magic);
 	if (magic != FDT_MAGIC)
 		die("Blob has incorrect magic number\n");
 
-	rc = fread(&totalsize, sizeof(totalsize), 1, f);
-	if (ferror(f))
-		die("Error reading DT blob size: %s\n", strerror(errno));
-	if (rc < 1) {
-		if (feof(f))
-			die("EOF reading DT blob size\n");
-		else
-			die("Mysterious short read reading blob size\n");
-	}
+	if (len < sizeof(fdt->magic) + sizeof(fdt->totalsize))
+		die("EOF reading DT blob size\n");
 
-	totalsize = fdt32_to_cpu(totalsize);
+	totalsize = fdt32_to_cpu(fdt->totalsize);
 	if (totalsize < FDT_V1_SIZE)
 		die("DT blob size (%d) is too small\n", totalsize);
 
-	blob = xmalloc(totalsize);
-
-	fdt = (struct fdt_header *)blob;
-	fdt->magic = cpu_to_fdt32(magic);
-	fdt->totalsize = cpu_to_fdt32(totalsize);
+	if (totalsize > len)
+		die("EOF before reading %d bytes of DT blob\n", totalsize);
 
-	sizeleft = totalsize - sizeof(magic) - sizeof(totalsize);
-	p = blob + sizeof(magic)  + sizeof(totalsize);
-
-	while (sizeleft) {
-		if (feof(f))
-			die("EOF before reading %d bytes of DT blob\n",
-			    totalsize);
-
-		rc = fread(p, 1, sizeleft, f);
-		if (ferror(f))
-			die("Error reading DT blob: %s\n",
-			    strerror(errno));
+	return blob;
+}
 
-		sizeleft -= rc;
-		p += rc;
-	}
+/* Set up to read each block of a blob, and return its version */
+static uint32_t blob_blocks(char *blob, struct inbuf *memresvbuf,
+			    struct inbuf *dtbuf, struct inbuf *strbuf)
+{
+	struct fdt_header *fdt = (struct fdt_header *)blob;
+	uint32_t totalsize, version, size_dt;
+	uint32_t off_dt, off_str, off_mem_rsvmap;
 
+	totalsize = fdt32_to_cpu(fdt->totalsize);
 	off_dt = fdt32_to_cpu(fdt->off_dt_struct);
 	off_str = fdt32_to_cpu(fdt->off_dt_strings);
 	off_mem_rsvmap = fdt32_to_cpu(fdt->off_mem_rsvmap);
 	version = fdt32_to_cpu(fdt->version);
-	boot_cpuid_phys = fdt32_to_cpu(fdt->boot_cpuid_phys);
 
 	if (off_mem_rsvmap >= totalsize)
 		die("Mem Reserve structure offset exceeds total size\n");
@@ -891,9 +1273,9 @@ struct boot_info *dt_from_blob(const char *fname)
 		uint32_t size_str = fdt32_to_cpu(fdt->size_dt_strings);
 		if (off_str+size_str > totalsize)
 			die("String table extends past total size\n");
-		inbuf_init(&strbuf, blob + off_str, blob + off_str + size_str);
+		inbuf_init(strbuf, blob + off_str, blob + off_str + size_str);
 	} else {
-		inbuf_init(&strbuf, blob + off_str, blob + totalsize);
+		inbuf_init(strbuf, blob + off_str, blob + totalsize);
 	}
 
 	if (version >= 17) {
@@ -902,16 +1284,33 @@ struct boot_info *dt_from_blob(const char *fname)
 			die("Structure block extends past total size\n");
 	}
 
+	inbuf_init(memresvbuf,
+		   blob + off_mem_rsvmap, blob + totalsize);
+	inbuf_init(dtbuf, blob + off_dt, blob + totalsize);
+
+	return version;
+}
+
+struct boot_info *dt_from_blob(char *blob)
+{
+	struct fdt_header *fdt = (struct fdt_header *)blob;
+	uint32_t version, boot_cpuid_phys;
+	struct inbuf dtbuf, strbuf;
+	struct inbuf memresvbuf;
+	struct reserve_info *reservelist;
+	struct node *tree;
+	uint32_t val;
+	int flags = 0;
+
+	version = blob_blocks(blob, &memresvbuf, &dtbuf, &strbuf);
+	boot_cpuid_phys = fdt32_to_cpu(fdt->boot_cpuid_phys);
+
 	if (version < 16) {
 		flags |= FTF_FULLPATH | FTF_NAMEPROPS | FTF_VARALIGN;
 	} else {
 		flags |= FTF_NOPS;
 	}
 
-	inbuf_init(&memresvbuf,
-		   blob + off_mem_rsvmap, blob + totalsize);
-	inbuf_init(&dtbuf, blob + off_dt, blob + totalsize);
-
 	reservelist = flat_read_mem_reserve(&memresvbuf);
 
 	val = flat_read_word(&dtbuf);
@@ -925,9 +1324,99 @@ struct boot_info *dt_from_blob(const char *fname)
 	if (val != FDT_END)
 		die("Device tree blob doesn't end with FDT_END\n");
 
-	free(blob);
+	return build_boot_info(reservelist, tree, boot_cpuid_phys);
+}
 
-	fclose(f);
+/*
+ * Check that a version 16 or later structure block is well formed, as
+ * unflatten_tree() would, without building a tree, and return its size.
+ */
+static int check_struct_block(struct inbuf *dtbuf, struct inbuf *strbuf)
+{
+	uint32_t val, proplen;
+	int depth = 0;
 
-	return build_boot_info(reservelist, tree, boot_cpuid_phys);
+	val = flat_read_word(dtbuf);
+	if (val != FDT_BEGIN_NODE)
+		die("Device tree blob doesn't begin with FDT_BEGIN_NODE (begins with 0x%08x)\n", val);
+
+	flat_skip_string(dtbuf);
+	depth++;
+	while (depth) {
+		val = flat_read_word(dtbuf);
+		switch (val) {
+		case FDT_BEGIN_NODE:
+			flat_skip_string(dtbuf);
+			depth++;
+			break;
+
+		case FDT_END_NODE:
+			depth--;
+			break;
+
+		case FDT_PROP:
+			proplen = flat_read_word(dtbuf);
+			flat_check_stringtable(strbuf, flat_read_word(dtbuf));
+			if (proplen > dtbuf->limit - dtbuf->ptr)
+				die("Premature end of data parsing flat device tree\n");
+			dtbuf->ptr += proplen;
+			flat_realign(dtbuf, sizeof(uint32_t));
+			break;
+
+		case FDT_END:
+			die("Premature FDT_END in device tree blob\n");
+			break;
+
+		case FDT_NOP:
+			break;
+
+		default:
+			die("Invalid opcode word %08x in device tree blob\n",
+			    val);
+		}
+	}
+
+	val = flat_read_word(dtbuf);
+	if (val != FDT_END)
+		die("Device tree blob doesn't end with FDT_END\n");
+
+	return dtbuf->ptr - dtbuf->base;
+}
+
+char *dt_copy_blob(char *inblob, int version, long long boot_cpuid)
+{
+	struct fdt_header *infdt = (struct fdt_header *)inblob;
+	struct version_info *vi;
+	struct inbuf dtbuf, strbuf;
+	struct inbuf memresvbuf;
+	struct fdt_reserve_entry re;
+	struct fdt_header fdt;
+	int reservesize, dtsize;
+	char *blob;
+
+	vi = find_version(version);
+	if (!(vi->flags & FTF_NOPS) ||
+	    blob_blocks(inblob, &memresvbuf, &dtbuf, &strbuf) < 16)
+		return NULL;
+
+	if (boot_cpuid == -1)
+		boot_cpuid = fdt32_to_cpu(infdt->boot_cpuid_phys);
+
+	do {
+		flat_read_chunk(&memresvbuf, &re, sizeof(re));
+	} while (re.size != 0);
+	reservesize = memresvbuf.ptr - memresvbuf.base - sizeof(re);
+
+	dtsize = check_struct_block(&dtbuf, &strbuf);
+
+	make_blob_header(&fdt, vi, reservesize, dtsize,
+			 strbuf.limit - strbuf.base, boot_cpuid);
+
+	blob = alloc_blob(&fdt, vi);
+	memcpy(blob + fdt32_to_cpu(fdt.off_mem_rsvmap), memresvbuf.base,
+	       reservesize);
+	memcpy(blob + fdt32_to_cpu(fdt.off_dt_struct), dtbuf.base, dtsize);
+	finish_blob(blob, strbuf.base, strbuf.limit - strbuf.base);
+
+	return blob;
 }
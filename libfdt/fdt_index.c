@@ -0,0 +1,603 @@
+/*
+ * libfdt - Flat Device Tree manipulation
+ *
+ * libfdt is dual licensed: you can use it either under the terms of
+ * the GPL, or the BSD license, at your option.
+ *
+ *  a) This library is free software; you can redistribute it and/or
+ *     modify it under the terms of the GNU General Public License as
+ *     published by the Free Software Foundation; either version 2 of the
+ *     License, or (at your option) any later version.
+ *
+ *     This library is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public
+ *     License along with this library; if not, write to the Free
+ *     Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *     MA 02110-1301 USA
+ *
+ * Alternatively,
+ *
+ *  b) Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *     1. Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *     2. Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "libfdt_env.h"
+
+#include <fdt.h>
+#include <libfdt.h>
+
+#include "libfdt_internal.h"
+
+/**
+ * _fdt_index_count() - count the nodes in a tree
+ *
+ * @fdt: FDT blob
+ * @return number of nodes, or -ve error value
+ */
+static int _fdt_index_count(const void *fdt)
+{
+	int offset, depth, count = 0;
+
+	for (offset = 0, depth = 0;
+	     (offset >= 0) && (depth >= 0);
+	     offset = fdt_next_node(fdt, offset, &depth))
+		count++;
+
+	if (depth < 0)
+		return count;
+	return offset < 0 ? offset : -FDT_ERR_BADSTRUCTURE;
+}
+
+static int _fdt_index_buckets(int num_nodes)
+{
+	int num_buckets = 1;
+
+	while (num_buckets < num_nodes)
+		num_buckets <<= 1;
+	return num_buckets;
+}
+
+static int _fdt_index_bytes(int num_nodes)
+{
+	return num_nodes * sizeof(struct fdt_index_node)
+		+ 2 * _fdt_index_buckets(num_nodes) * sizeof(int)
+		+ sizeof(int) - 1;	/* for aligning the buffer */
+}
+
+/* Hash of a node name within its parent */
+static uint32_t _fdt_index_hash(int parent, const char *name, int namelen)
+{
+	uint32_t hash;
+
+	hash = _fdt_hash(FDT_HASH_INIT, (const char *)&parent, sizeof(parent));
+	return _fdt_hash(hash, name, namelen);
+}
+
+static int _fdt_index_valid(const void *fdt, const struct fdt_index *index)
+{
+	return index && (index->fdt == fdt)
+		&& (index->size_dt_struct == fdt_size_dt_struct(fdt));
+}
+
+int fdt_index_size(const void *fdt)
+{
+	int count;
+
+	FDT_CHECK_HEADER(fdt);
+
+	count = _fdt_index_count(fdt);
+	if (count < 0)
+		return count;
+
+	return _fdt_index_bytes(count);
+}
+
+int fdt_index_build(const void *fdt, struct fdt_index *index, void *buf,
+		    int bufsize)
+{
+	struct fdt_index_node *node;
+	int offset, depth, prev_depth = -1;
+	int count, n, parent, i;
+	const char *name, *at;
+	int namelen;
+	uint32_t hash;
+
+	FDT_CHECK_HEADER(fdt);
+
+	count = _fdt_index_count(fdt);
+	if (count < 0)
+		return count;
+	if (bufsize < _fdt_index_bytes(count))
+		return -FDT_ERR_NOSPACE;
+
+	index->fdt = fdt;
+	index->size_dt_struct = fdt_size_dt_struct(fdt);
+	index->num_nodes = count;
+	index->hash_mask = _fdt_index_buckets(count) - 1;
+	index->node = (struct fdt_index_node *)
+		FDT_ALIGN((uintptr_t)buf, sizeof(int));
+	index->bucket = (int *)(index->node + count);
+	index->base_bucket = index->bucket + index->hash_mask + 1;
+	for (i = 0; i <= index->hash_mask; i++)
+		index->bucket[i] = index->base_bucket[i] = -1;
+
+	for (offset = 0, depth = 0, n = 0;
+	     (offset >= 0) && (depth >= 0);
+	     offset = fdt_next_node(fdt, offset, &depth), n++) {
+		/* Walk up from the previous node to find our parent */
+		parent = n - 1;
+		for (i = prev_depth; i >= depth; i--)
+			parent = index->node[parent].parent;
+		prev_depth = depth;
+
+		name = fdt_get_name(fdt, offset, &namelen);
+		if (!name)
+			return namelen;
+
+		node = &index->node[n];
+		node->offset = offset;
+		node->parent = parent;
+
+		hash = _fdt_index_hash(parent, name, namelen);
+		node->next = index->bucket[hash & index->hash_mask];
+		index->bucket[hash & index->hash_mask] = n;
+
+		/*
+		 * Nodes with a unit address can also be found by their base
+		 * name, so put them in a second table too.
+		 */
+		at = memchr(name, '@', namelen);
+		node->next_base = -1;
+		if (at) {
+			hash = _fdt_index_hash(parent, name, at - name);
+			node->next_base =
+				index->base_bucket[hash & index->hash_mask];
+			index->base_bucket[hash & index->hash_mask] = n;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * _fdt_index_lookup() - find the index of a node given its parent's index
+ *
+ * This has the same matching rules as fdt_subnode_offset_namelen(): if
+ * @name has no unit address it will also match a node with one, and the
+ * first matching node in the tree wins.
+ *
+ * @return index of node, or -1 if not found
+ */
+static int _fdt_index_lookup(const void *fdt, const struct fdt_index *index,
+			     int parent, const char *name, int namelen)
+{
+	const struct fdt_index_node *node;
+	uint32_t hash;
+	int found = -1;
+	int i;
+
+	hash = _fdt_index_hash(parent, name, namelen) & index->hash_mask;
+	for (i = index->bucket[hash]; i >= 0; i = node->next) {
+		node = &index->node[i];
+		if ((node->parent == parent) && (found < 0 || i < found)
+		    && _fdt_nodename_eq(fdt, node->offset, name, namelen))
+			found = i;
+	}
+
+	if (memchr(name, '@', namelen))
+		return found;
+
+	for (i = index->base_bucket[hash]; i >= 0; i = node->next_base) {
+		node = &index->node[i];
+		if ((node->parent == parent) && (found < 0 || i < found)
+		    && _fdt_nodename_eq(fdt, node->offset, name, namelen))
+			found = i;
+	}
+
+	return found;
+}
+
+/* Find the index of the node at @offset, or -1 if there is none */
+static int _fdt_index_find_offset(const struct fdt_index *index, int offset)
+{
+	int low = 0, high = index->num_nodes - 1;
+	int mid;
+
+	/* Nodes are stored in tree order, so offsets are sorted */
+	while (low <= high) {
+		mid = low + (high - low) / 2;
+		if (index->node[mid].offset == offset)
+			return mid;
+		if (index->node[mid].offset < offset)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return -1;
+}
+
+int fdt_index_subnode_offset_namelen(const void *fdt,
+				     const struct fdt_index *index,
+				     int parentoffset, const char *name,
+				     int namelen)
+{
+	int parent, i;
+
+	FDT_CHECK_HEADER(fdt);
+
+	if (!_fdt_index_valid(fdt, index))
+		return fdt_subnode_offset_namelen(fdt, parentoffset, name,
+						  namelen);
+
+	parent = _fdt_index_find_offset(index, parentoffset);
+	if (parent < 0)
+		/* let the normal code sort out what is wrong */
+		return fdt_subnode_offset_namelen(fdt, parentoffset, name,
+						  namelen);
+
+	i = _fdt_index_lookup(fdt, index, parent, name, namelen);
+	if (i < 0)
+		return -FDT_ERR_NOTFOUND;
+
+	return index->node[i].offset;
+}
+
+int fdt_index_subnode_offset(const void *fdt, const struct fdt_index *index,
+			     int parentoffset, const char *name)
+{
+	return fdt_index_subnode_offset_namelen(fdt, index, parentoffset, name,
+						strlen(name));
+}
+
+int fdt_index_path_offset_namelen(const void *fdt,
+				  const struct fdt_index *index,
+				  const char *path, int namelen)
+{
+	const char *end = path + namelen;
+	const char *p = path;
+	int i = 0;
+
+	FDT_CHECK_HEADER(fdt);
+
+	if (!_fdt_index_valid(fdt, index))
+		return fdt_path_offset_namelen(fdt, path, namelen);
+
+	/* see if we have an alias */
+	if (*path != '/') {
+		const char *q = memchr(path, '/', end - p);
+		const char *alias;
+		int aliases, offset;
+
+		if (!q)
+			q = end;
+
+		aliases = _fdt_index_lookup(fdt, index, 0, "aliases", 7);
+		if (aliases < 0)
+			return -FDT_ERR_BADPATH;
+		alias = fdt_getprop_namelen(fdt, index->node[aliases].offset,
+					    p, q - p, NULL);
+		if (!alias)
+			return -FDT_ERR_BADPATH;
+		offset = fdt_index_path_offset(fdt, index, alias);
+		if (offset < 0)
+			return offset;
+		i = _fdt_index_find_offset(index, offset);
+
+		p = q;
+	}
+
+	while (p < end) {
+		const char *q;
+
+		while (*p == '/') {
+			p++;
+			if (p == end)
+				return index->node[i].offset;
+		}
+		q = memchr(p, '/', end - p);
+		if (! q)
+			q = end;
+
+		i = _fdt_index_lookup(fdt, index, i, p, q - p);
+		if (i < 0)
+			return -FDT_ERR_NOTFOUND;
+
+		p = q;
+	}
+
+	return index->node[i].offset;
+}
+
+int fdt_index_path_offset(const void *fdt, const struct fdt_index *index,
+			  const char *path)
+{
+	return fdt_index_path_offset_namelen(fdt, index, path, strlen(path));
+}
+
+static int _fdt_phandle_cache_slots(int count)
+{
+	/* Keep the table at most half full so probe sequences stay short */
+	return _fdt_index_buckets(count < 1 ? 2 : count * 2);
+}
+
+static int _fdt_phandle_cache_fill(const void *fdt,
+				   struct fdt_phandle_cache *cache)
+{
+	struct fdt_phandle_entry *entry;
+	uint32_t phandle, slot;
+	int offset, count = 0;
+	int i;
+
+	cache->fdt = NULL;
+	cache->full = 0;
+	for (i = 0; i <= cache->hash_mask; i++)
+		cache->entry[i].phandle = 0;
+
+	for (offset = fdt_next_node(fdt, -1, NULL);
+	     offset >= 0;
+	     offset = fdt_next_node(fdt, offset, NULL)) {
+		phandle = fdt_get_phandle(fdt, offset);
+		if ((phandle == 0) || (phandle == -1))
+			continue;
+
+		slot = _fdt_hash(FDT_HASH_INIT, (const char *)&phandle,
+				 sizeof(phandle));
+		for (;; slot++) {
+			entry = &cache->entry[slot & cache->hash_mask];
+			if (!entry->phandle || (entry->phandle == phandle))
+				break;
+		}
+		/* If phandles are duplicated, the first node wins */
+		if (entry->phandle)
+			continue;
+		if (++count * 2 > cache->hash_mask + 1) {
+			/* Don't try again until the tree changes */
+			cache->fdt = fdt;
+			cache->size_dt_struct = fdt_size_dt_struct(fdt);
+			cache->full = 1;
+			return -FDT_ERR_NOSPACE;
+		}
+		entry->phandle = phandle;
+		entry->offset = offset;
+	}
+	if (offset != -FDT_ERR_NOTFOUND)
+		return offset;
+
+	cache->fdt = fdt;
+	cache->size_dt_struct = fdt_size_dt_struct(fdt);
+	return 0;
+}
+
+int fdt_phandle_cache_size(const void *fdt)
+{
+	uint32_t phandle;
+	int offset, count = 0;
+
+	FDT_CHECK_HEADER(fdt);
+
+	for (offset = fdt_next_node(fdt, -1, NULL);
+	     offset >= 0;
+	     offset = fdt_next_node(fdt, offset, NULL)) {
+		phandle = fdt_get_phandle(fdt, offset);
+		if ((phandle != 0) && (phandle != -1))
+			count++;
+	}
+	if (offset != -FDT_ERR_NOTFOUND)
+		return offset;
+
+	return _fdt_phandle_cache_slots(count)
+		* sizeof(struct fdt_phandle_entry)
+		+ sizeof(uint32_t) - 1;	/* for aligning the buffer */
+}
+
+int fdt_phandle_cache_build(const void *fdt, struct fdt_phandle_cache *cache,
+			    void *buf, int bufsize)
+{
+	int slots;
+
+	FDT_CHECK_HEADER(fdt);
+
+	cache->fdt = NULL;
+	cache->entry = (struct fdt_phandle_entry *)
+		FDT_ALIGN((uintptr_t)buf, sizeof(uint32_t));
+	bufsize -= (char *)cache->entry - (char *)buf;
+	if (bufsize < (int)sizeof(struct fdt_phandle_entry) * 2)
+		return -FDT_ERR_NOSPACE;
+
+	/* Use as much of the buffer as we can, to allow for later growth */
+	for (slots = 2; slots * 2 * sizeof(struct fdt_phandle_entry) <= bufsize;)
+		slots *= 2;
+	cache->hash_mask = slots - 1;
+
+	return _fdt_phandle_cache_fill(fdt, cache);
+}
+
+/* Look up a phandle in the cache, returning its offset or -1 */
+static int _fdt_phandle_cache_lookup(const void *fdt,
+				     const struct fdt_phandle_cache *cache,
+				     uint32_t phandle)
+{
+	const struct fdt_phandle_entry *entry;
+	uint32_t slot;
+
+	slot = _fdt_hash(FDT_HASH_INIT, (const char *)&phandle,
+			 sizeof(phandle));
+	for (;; slot++) {
+		entry = &cache->entry[slot & cache->hash_mask];
+		if (!entry->phandle)
+			return -1;
+		if (entry->phandle == phandle)
+			break;
+	}
+
+	/* Check the node is still there, in case the tree has changed */
+	if (fdt_get_phandle(fdt, entry->offset) != phandle)
+		return -1;
+
+	return entry->offset;
+}
+
+int fdt_node_offset_by_phandle_cache(const void *fdt,
+				     struct fdt_phandle_cache *cache,
+				     uint32_t phandle)
+{
+	int offset;
+
+	if ((phandle == 0) || (phandle == -1))
+		return -FDT_ERR_BADPHANDLE;
+
+	FDT_CHECK_HEADER(fdt);
+
+	if (!cache)
+		return fdt_node_offset_by_phandle(fdt, phandle);
+
+	if ((cache->fdt != fdt)
+	    || (cache->size_dt_struct != fdt_size_dt_struct(fdt)))
+		_fdt_phandle_cache_fill(fdt, cache);
+
+	if (cache->full)
+		return fdt_node_offset_by_phandle(fdt, phandle);
+
+	if (cache->fdt) {
+		offset = _fdt_phandle_cache_lookup(fdt, cache, phandle);
+		if (offset >= 0)
+			return offset;
+	}
+
+	/*
+	 * Either the phandle does not exist, or the tree was changed in a
+	 * way which did not alter its size. Search the hard way and if that
+	 * finds the node, the cache is out of date.
+	 */
+	offset = fdt_node_offset_by_phandle(fdt, phandle);
+	if (offset >= 0)
+		_fdt_phandle_cache_fill(fdt, cache);
+
+	return offset;
+}
+
+int fdt_strhash_init(struct fdt_strhash *sh, int32_t *slot, int num_slots)
+{
+	if (num_slots < 2)
+		return -FDT_ERR_NOSPACE;
+
+	sh->fdt = NULL;
+	sh->slot = slot;
+	for (sh->mask = 1; (sh->mask << 1) <= num_slots; sh->mask <<= 1)
+		;
+	sh->mask--;
+
+	return 0;
+}
+
+/* Find the slot for a string: the one holding it, or an empty one */
+static int32_t *_fdt_strhash_slot(struct fdt_strhash *sh, const char *base,
+				  const char *s, int len)
+{
+	uint32_t i = _fdt_hash(FDT_HASH_INIT, s, len);
+	int32_t *slot;
+
+	for (;; i++) {
+		slot = &sh->slot[i & sh->mask];
+		if ((*slot == FDT_STRHASH_EMPTY)
+		    || (memcmp(base + *slot, s, len) == 0))
+			return slot;
+	}
+}
+
+static void _fdt_strhash_insert(struct fdt_strhash *sh, const char *base,
+				const char *p, int len)
+{
+	int32_t *slot;
+
+	/* Keep at least a quarter of the table free */
+	if ((sh->count + 1) * 4 > (sh->mask + 1) * 3) {
+		sh->complete = 0;
+		return;
+	}
+
+	slot = _fdt_strhash_slot(sh, base, p, len);
+	if (*slot == FDT_STRHASH_EMPTY) {
+		*slot = p - base;
+		sh->count++;
+	}
+}
+
+int _fdt_strhash_find(struct fdt_strhash *sh, const void *fdt,
+		      const char *strtab, int tabsize, const char *base,
+		      const char *s, int len, const char **pp)
+{
+	const char *p, *end;
+	int32_t *slot;
+	int i;
+
+	if (!sh)
+		return -1;
+
+	/* Rehash the whole block if it was changed behind our back */
+	if ((sh->fdt != fdt) || (sh->tabsize != tabsize)) {
+		for (i = 0; i <= sh->mask; i++)
+			sh->slot[i] = FDT_STRHASH_EMPTY;
+		sh->fdt = fdt;
+		sh->tabsize = tabsize;
+		sh->count = 0;
+		sh->complete = 1;
+
+		end = strtab + tabsize;
+		for (p = strtab; p < end; p = p + i) {
+			const char *nul = memchr(p, '\0', end - p);
+
+			if (!nul)
+				break;
+			i = nul - p + 1;
+			_fdt_strhash_insert(sh, base, p, i);
+		}
+	}
+
+	slot = _fdt_strhash_slot(sh, base, s, len);
+	if (*slot != FDT_STRHASH_EMPTY) {
+		*pp = base + *slot;
+		return 1;
+	}
+
+	/* Only a complete table can tell us that a string is not there */
+	return sh->complete ? 0 : -1;
+}
+
+void _fdt_strhash_add(struct fdt_strhash *sh, const void *fdt, int tabsize,
+		      const char *base, const char *p, int len)
+{
+	if (!sh || (sh->fdt != fdt))
+		return;
+
+	sh->tabsize = tabsize;
+	_fdt_strhash_insert(sh, base, p, len);
+}
@@ -55,8 +55,7 @@
 
 #include "libfdt_internal.h"
 
-static int _fdt_nodename_eq(const void *fdt, int offset,
-			    const char *s, int len)
+int _fdt_nodename_eq(const void *fdt, int offset, const char *s, int len)
 {
 	const char *p = fdt_offset_ptr(fdt, offset + FDT_TAGSIZE, len+1);
 
@@ -147,17 +147,22 @@ static int _fdt_splice_string(void *fdt, int newlen)
 	return 0;
 }
 
-static int _fdt_find_add_string(void *fdt, const char *s)
+static int _fdt_find_add_string(void *fdt, struct fdt_strhash *sh,
+				const char *s)
 {
 	char *strtab = (char *)fdt + fdt_off_dt_strings(fdt);
 	const char *p;
 	char *new;
 	int len = strlen(s) + 1;
-	int err;
+	int err, found;
 
-	p = _fdt_find_string(strtab, fdt_size_dt_strings(fdt), s);
-	if (p)
-		/* found it */
+	found = _fdt_strhash_find(sh, fdt, strtab, fdt_size_dt_strings(fdt),
+				  strtab, s, len, &p);
+	if (found < 0) {
+		p = _fdt_find_string(strtab, fdt_size_dt_strings(fdt), s);
+		found = (p != NULL);
+	}
+	if (found)
 		return (p - strtab);
 
 	new = strtab + fdt_size_dt_strings(fdt);
@@ -166,6 +171,7 @@ static int _fdt_find_add_string(void *fdt, const char *s)
 		return err;
 
 	memcpy(new, s, len);
+	_fdt_strhash_add(sh, fdt, fdt_size_dt_strings(fdt), strtab, new, len);
 	return (new - strtab);
 }
 
@@ -220,7 +226,8 @@ static int _fdt_resize_property(void *fdt, int nodeoffset, const char *name,
 	return 0;
 }
 
-static int _fdt_add_property(void *fdt, int nodeoffset, const char *name,
+static int _fdt_add_property(void *fdt, struct fdt_strhash *sh,
+			     int nodeoffset, const char *name,
 			     int len, struct fdt_property **prop)
 {
 	int proplen;
@@ -231,7 +238,7 @@ static int _fdt_add_property(void *fdt, int nodeoffset, const char *name,
 	if ((nextoffset = _fdt_check_node_offset(fdt, nodeoffset)) < 0)
 		return nextoffset;
 
-	namestroff = _fdt_find_add_string(fdt, name);
+	namestroff = _fdt_find_add_string(fdt, sh, name);
 	if (namestroff < 0)
 		return namestroff;
 
@@ -271,8 +278,8 @@ int fdt_set_name(void *fdt, int nodeoffset, const char *name)
 	return 0;
 }
 
-int fdt_setprop(void *fdt, int nodeoffset, const char *name,
-		const void *val, int len)
+int fdt_setprop_strhash(void *fdt, struct fdt_strhash *sh, int nodeoffset,
+			const char *name, const void *val, int len)
 {
 	struct fdt_property *prop;
 	int err;
@@ -281,14 +288,21 @@ int fdt_setprop(void *fdt, int nodeoffset, const char *name,
 
 	err = _fdt_resize_property(fdt, nodeoffset, name, len, &prop);
 	if (err == -FDT_ERR_NOTFOUND)
-		err = _fdt_add_property(fdt, nodeoffset, name, len, &prop);
+		err = _fdt_add_property(fdt, sh, nodeoffset, name, len, &prop);
 	if (err)
 		return err;
 
 	memcpy(prop->data, val, len);
+	memset(prop->data + len, 0, FDT_TAGALIGN(len) - len);
 	return 0;
 }
 
+int fdt_setprop(void *fdt, int nodeoffset, const char *name,
+		const void *val, int len)
+{
+	return fdt_setprop_strhash(fdt, NULL, nodeoffset, name, val, len);
+}
+
 int fdt_appendprop(void *fdt, int nodeoffset, const char *name,
 		   const void *val, int len)
 {
@@ -308,11 +322,14 @@ int fdt_appendprop(void *fdt, int nodeoffset, const char *name,
 		prop->len = cpu_to_fdt32(newlen);
 		memcpy(prop->data + oldlen, val, len);
 	} else {
-		err = _fdt_add_property(fdt, nodeoffset, name, len, &prop);
+		err = _fdt_add_property(fdt, NULL, nodeoffset, name, len,
+					&prop);
 		if (err)
 			return err;
 		memcpy(prop->data, val, len);
+		newlen = len;
 	}
+	memset(prop->data + newlen, 0, FDT_TAGALIGN(newlen) - newlen);
 	return 0;
 }
 
@@ -514,7 +531,7 @@ int fdt_remove_unused_strings(const void *old, void *new)
 		new_prop = (struct fdt_property *)(unsigned long)
 			fdt_get_property_by_offset(new, offset, NULL);
 		str = fdt_string(old, fdt32_to_cpu(old_prop->nameoff));
-		ret = _fdt_find_add_string(new, str);
+		ret = _fdt_find_add_string(new, NULL, str);
 		if (ret < 0)
 			return ret;
 		new_prop->nameoff = cpu_to_fdt32(ret);
@@ -522,3 +539,489 @@ int fdt_remove_unused_strings(const void *old, void *new)
 
 	return 0;
 }
+
+/* Flags used privately in struct fdt_edit_op */
+#define FDT_EDIT_DEAD		(1 << 0)	/* no effect on the struct block */
+#define FDT_EDIT_NEWSTR		(1 << 1)	/* appends its name to strings */
+
+int fdt_edit_begin(struct fdt_edit *ed, void *fdt, struct fdt_edit_op *op,
+		   int max_ops)
+{
+	FDT_RW_CHECK_HEADER(fdt);
+
+	ed->fdt = fdt;
+	ed->size_dt_struct = fdt_size_dt_struct(fdt);
+	ed->size_dt_strings = fdt_size_dt_strings(fdt);
+	ed->new_strings = 0;
+	ed->op = op;
+	ed->num_ops = 0;
+	ed->max_ops = max_ops;
+
+	return 0;
+}
+
+/* Check that a node exists and has not been deleted by a queued operation */
+static int _fdt_edit_check_node(struct fdt_edit *ed, int nodeoffset)
+{
+	const struct fdt_edit_op *op;
+	int err;
+
+	err = _fdt_check_node_offset(ed->fdt, nodeoffset);
+	if (err < 0)
+		return err;
+
+	for (op = ed->op; op < ed->op + ed->num_ops; op++)
+		if ((op->type == FDT_EDIT_DEL_NODE)
+		    && (nodeoffset >= op->offset)
+		    && (nodeoffset < op->offset + op->oldlen))
+			return -FDT_ERR_BADOFFSET;
+
+	return 0;
+}
+
+/* Get a new operation, filling in the fields common to all types */
+static struct fdt_edit_op *_fdt_edit_new_op(struct fdt_edit *ed, int type,
+					    int nodeoffset, const char *name)
+{
+	struct fdt_edit_op *op;
+
+	if (ed->num_ops >= ed->max_ops)
+		return NULL;
+
+	op = &ed->op[ed->num_ops];
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	op->nodeoffset = nodeoffset;
+	op->name = name;
+	op->namelen = name ? strlen(name) : 0;
+	op->seq = ed->num_ops;
+	op->ref = ed->num_ops;
+
+	return op;
+}
+
+/*
+ * Find the last queued property operation for a property, if any. Also
+ * return the original property, or -FDT_ERR_NOTFOUND if there is none.
+ */
+static struct fdt_edit_op *_fdt_edit_find_prop(struct fdt_edit *ed,
+					       int nodeoffset,
+					       const char *name,
+					       struct fdt_property **propp,
+					       int *lenp)
+{
+	struct fdt_edit_op *op;
+	int namelen = strlen(name);
+
+	*propp = NULL;
+	*lenp = -FDT_ERR_NOTFOUND;
+	for (op = ed->op + ed->num_ops - 1; op >= ed->op; op--) {
+		if ((op->type != FDT_EDIT_SETPROP)
+		    && (op->type != FDT_EDIT_DELPROP))
+			continue;
+		if ((op->nodeoffset == nodeoffset) && (op->namelen == namelen)
+		    && (memcmp(op->name, name, namelen) == 0))
+			return op;
+	}
+
+	*propp = fdt_get_property_w(ed->fdt, nodeoffset, name, lenp);
+	return NULL;
+}
+
+/*
+ * Find the offset a new property name will have in the strings block,
+ * allowing for the strings added by earlier operations.
+ */
+static void _fdt_edit_find_add_string(struct fdt_edit *ed,
+				      struct fdt_edit_op *op)
+{
+	const char *strtab = (char *)ed->fdt + fdt_off_dt_strings(ed->fdt);
+	const struct fdt_edit_op *prev;
+	const char *p;
+
+	p = _fdt_find_string(strtab, ed->size_dt_strings, op->name);
+	if (p) {
+		op->nameoff = p - strtab;
+		return;
+	}
+
+	/* Earlier strings come first, so are found first */
+	for (prev = ed->op; prev < op; prev++) {
+		if (!(prev->flags & FDT_EDIT_NEWSTR)
+		    || (prev->namelen < op->namelen))
+			continue;
+		p = prev->name + prev->namelen - op->namelen;
+		if (memcmp(p, op->name, op->namelen) == 0) {
+			op->nameoff = prev->nameoff + (p - prev->name);
+			return;
+		}
+	}
+
+	op->nameoff = ed->size_dt_strings + ed->new_strings;
+	op->flags |= FDT_EDIT_NEWSTR;
+	ed->new_strings += op->namelen + 1;
+}
+
+int fdt_edit_setprop(struct fdt_edit *ed, int nodeoffset, const char *name,
+		     const void *val, int len)
+{
+	struct fdt_edit_op *op, *prev, *live;
+	struct fdt_property *prop;
+	int err, oldlen;
+
+	err = _fdt_edit_check_node(ed, nodeoffset);
+	if (err)
+		return err;
+	op = _fdt_edit_new_op(ed, FDT_EDIT_SETPROP, nodeoffset, name);
+	if (!op)
+		return -FDT_ERR_NOSPACE;
+	op->val = val;
+	op->len = len;
+
+	prev = _fdt_edit_find_prop(ed, nodeoffset, name, &prop, &oldlen);
+	if (prev && (prev->type == FDT_EDIT_SETPROP)) {
+		/* Just update the value set by the earlier operation */
+		live = &ed->op[prev->ref];
+		live->val = val;
+		live->len = len;
+		op->ref = prev->ref;
+		op->flags |= FDT_EDIT_DEAD;
+	} else if (!prev && prop) {
+		/* Replace the original property */
+		op->offset = (char *)prop - (char *)ed->fdt
+			- fdt_off_dt_struct(ed->fdt);
+		op->oldlen = sizeof(*prop) + FDT_TAGALIGN(oldlen);
+		op->nameoff = fdt32_to_cpu(prop->nameoff);
+	} else if (!prev && (oldlen != -FDT_ERR_NOTFOUND)) {
+		return oldlen;
+	} else {
+		/* Add a new property at the start of the node */
+		op->offset = _fdt_check_node_offset(ed->fdt, nodeoffset);
+		_fdt_edit_find_add_string(ed, op);
+	}
+
+	ed->num_ops++;
+	return 0;
+}
+
+int fdt_edit_delprop(struct fdt_edit *ed, int nodeoffset, const char *name)
+{
+	struct fdt_edit_op *op, *prev, *live;
+	struct fdt_property *prop;
+	int err, oldlen;
+
+	err = _fdt_edit_check_node(ed, nodeoffset);
+	if (err)
+		return err;
+	op = _fdt_edit_new_op(ed, FDT_EDIT_DELPROP, nodeoffset, name);
+	if (!op)
+		return -FDT_ERR_NOSPACE;
+
+	prev = _fdt_edit_find_prop(ed, nodeoffset, name, &prop, &oldlen);
+	if (prev && (prev->type == FDT_EDIT_SETPROP)) {
+		live = &ed->op[prev->ref];
+		if (live->oldlen) {
+			/* Delete the original property instead of replacing */
+			live->type = FDT_EDIT_DELPROP;
+		} else {
+			/* Drop the new property (but not its name) */
+			live->flags |= FDT_EDIT_DEAD;
+		}
+		op->flags |= FDT_EDIT_DEAD;
+	} else if (!prev && prop) {
+		op->offset = (char *)prop - (char *)ed->fdt
+			- fdt_off_dt_struct(ed->fdt);
+		op->oldlen = sizeof(*prop) + FDT_TAGALIGN(oldlen);
+	} else {
+		return prev ? -FDT_ERR_NOTFOUND : oldlen;
+	}
+
+	ed->num_ops++;
+	return 0;
+}
+
+/* Compare node names in the same way as _fdt_nodename_eq() */
+static int _fdt_edit_name_eq(const char *p, int plen, const char *s, int len)
+{
+	if ((plen < len) || (memcmp(p, s, len) != 0))
+		return 0;
+	if (plen == len)
+		return 1;
+	if (memchr(s, '@', len))
+		return 0;
+	return p[len] == '@';
+}
+
+int fdt_edit_add_subnode(struct fdt_edit *ed, int parentoffset,
+			 const char *name)
+{
+	const struct fdt_edit_op *prev;
+	struct fdt_edit_op *op;
+	int offset, nextoffset;
+	uint32_t tag;
+	int err;
+
+	err = _fdt_edit_check_node(ed, parentoffset);
+	if (err)
+		return err;
+	op = _fdt_edit_new_op(ed, FDT_EDIT_ADD_SUBNODE, parentoffset, name);
+	if (!op)
+		return -FDT_ERR_NOSPACE;
+
+	/* Look for an existing subnode, skipping those already deleted */
+	for (offset = fdt_first_subnode(ed->fdt, parentoffset);
+	     offset >= 0;
+	     offset = fdt_next_subnode(ed->fdt, offset)) {
+		if (!_fdt_nodename_eq(ed->fdt, offset, op->name, op->namelen))
+			continue;
+		for (prev = ed->op; prev < op; prev++)
+			if ((prev->type == FDT_EDIT_DEL_NODE)
+			    && (prev->offset == offset))
+				break;
+		if (prev == op)
+			return -FDT_ERR_EXISTS;
+	}
+	if (offset != -FDT_ERR_NOTFOUND)
+		return offset;
+
+	for (prev = ed->op; prev < op; prev++)
+		if ((prev->type == FDT_EDIT_ADD_SUBNODE)
+		    && (prev->nodeoffset == parentoffset)
+		    && _fdt_edit_name_eq(prev->name, prev->namelen,
+					 op->name, op->namelen))
+			return -FDT_ERR_EXISTS;
+
+	/* Place the new node after the parent's properties */
+	fdt_next_tag(ed->fdt, parentoffset, &nextoffset);
+	do {
+		offset = nextoffset;
+		tag = fdt_next_tag(ed->fdt, offset, &nextoffset);
+	} while ((tag == FDT_PROP) || (tag == FDT_NOP));
+	op->offset = offset;
+
+	ed->num_ops++;
+	return 0;
+}
+
+int fdt_edit_del_node(struct fdt_edit *ed, int nodeoffset)
+{
+	struct fdt_edit_op *op;
+	int endoffset;
+	int err;
+
+	err = _fdt_edit_check_node(ed, nodeoffset);
+	if (err)
+		return err;
+	endoffset = _fdt_node_end_offset(ed->fdt, nodeoffset);
+	if (endoffset < 0)
+		return endoffset;
+	op = _fdt_edit_new_op(ed, FDT_EDIT_DEL_NODE, nodeoffset, NULL);
+	if (!op)
+		return -FDT_ERR_NOSPACE;
+
+	op->offset = nodeoffset;
+	op->oldlen = endoffset - nodeoffset;
+
+	ed->num_ops++;
+	return 0;
+}
+
+/*
+ * Order of changes at the same offset: new properties go before the
+ * node's existing properties and new subnodes after them. A deleted node
+ * comes after any new subnodes placed before it.
+ */
+static int _fdt_edit_rank(const struct fdt_edit_op *op)
+{
+	switch (op->type) {
+	case FDT_EDIT_SETPROP:
+		return op->oldlen ? 2 : 0;
+	case FDT_EDIT_ADD_SUBNODE:
+		return 1;
+	case FDT_EDIT_DELPROP:
+		return 2;
+	default:
+		return 3;
+	}
+}
+
+/*
+ * Return non-zero if @a must be applied after @b. Dead operations go
+ * last. Later additions at the same place end up first, as they would
+ * with fdt_setprop() and fdt_add_subnode().
+ */
+static int _fdt_edit_after(const struct fdt_edit_op *a,
+			   const struct fdt_edit_op *b)
+{
+	int adead = a->flags & FDT_EDIT_DEAD;
+	int bdead = b->flags & FDT_EDIT_DEAD;
+
+	if (adead != bdead)
+		return adead;
+	if (a->offset != b->offset)
+		return a->offset > b->offset;
+	if (_fdt_edit_rank(a) != _fdt_edit_rank(b))
+		return _fdt_edit_rank(a) > _fdt_edit_rank(b);
+	return a->seq < b->seq;
+}
+
+static void _fdt_edit_swap(struct fdt_edit_op *a, struct fdt_edit_op *b)
+{
+	struct fdt_edit_op tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/* Heap sort, since we cannot allocate memory */
+static void _fdt_edit_sort(struct fdt_edit_op *op, int count)
+{
+	int start, end, root, child;
+
+	for (start = count / 2 - 1, end = count - 1; end > 0; ) {
+		if (start >= 0) {
+			root = start--;
+		} else {
+			_fdt_edit_swap(&op[0], &op[end--]);
+			root = 0;
+		}
+		for (; (child = root * 2 + 1) <= end; root = child) {
+			if ((child < end) &&
+			    _fdt_edit_after(&op[child + 1], &op[child]))
+				child++;
+			if (!_fdt_edit_after(&op[child], &op[root]))
+				break;
+			_fdt_edit_swap(&op[root], &op[child]);
+		}
+	}
+}
+
+/* Size of the struct-block data which replaces op->oldlen bytes */
+static int _fdt_edit_newlen(const struct fdt_edit_op *op)
+{
+	switch (op->type) {
+	case FDT_EDIT_SETPROP:
+		return sizeof(struct fdt_property) + FDT_TAGALIGN(op->len);
+	case FDT_EDIT_ADD_SUBNODE:
+		return sizeof(struct fdt_node_header)
+			+ FDT_TAGALIGN(op->namelen + 1) + FDT_TAGSIZE;
+	default:
+		return 0;
+	}
+}
+
+static void _fdt_edit_write(const struct fdt_edit_op *op, char *p)
+{
+	struct fdt_property *prop = (struct fdt_property *)p;
+	struct fdt_node_header *nh = (struct fdt_node_header *)p;
+	int namelen = FDT_TAGALIGN(op->namelen + 1);
+	fdt32_t *endtag;
+
+	switch (op->type) {
+	case FDT_EDIT_SETPROP:
+		prop->tag = cpu_to_fdt32(FDT_PROP);
+		prop->nameoff = cpu_to_fdt32(op->nameoff);
+		prop->len = cpu_to_fdt32(op->len);
+		memcpy(prop->data, op->val, op->len);
+		memset(prop->data + op->len, 0,
+		       FDT_TAGALIGN(op->len) - op->len);
+		break;
+	case FDT_EDIT_ADD_SUBNODE:
+		nh->tag = cpu_to_fdt32(FDT_BEGIN_NODE);
+		memset(nh->name, 0, namelen);
+		memcpy(nh->name, op->name, op->namelen);
+		endtag = (fdt32_t *)(nh->name + namelen);
+		*endtag = cpu_to_fdt32(FDT_END_NODE);
+		break;
+	}
+}
+
+int fdt_edit_commit(struct fdt_edit *ed)
+{
+	void *fdt = ed->fdt;
+	struct fdt_edit_op *op, *end;
+	char *base, *strtab;
+	int data_end, delta, shift, start, skip, len, i;
+
+	FDT_RW_CHECK_HEADER(fdt);
+	if ((fdt_size_dt_struct(fdt) != ed->size_dt_struct)
+	    || (fdt_size_dt_strings(fdt) != ed->size_dt_strings))
+		return -FDT_ERR_BADSTATE;
+
+	_fdt_edit_sort(ed->op, ed->num_ops);
+
+	/* Drop changes inside deleted nodes, and work out the new size */
+	delta = 0;
+	skip = -1;
+	for (op = ed->op, end = op + ed->num_ops; op < end; op++) {
+		if (op->flags & FDT_EDIT_DEAD)
+			break;
+		if (op->offset < skip) {
+			op->flags |= FDT_EDIT_DEAD;
+			continue;
+		}
+		if (op->type == FDT_EDIT_DEL_NODE)
+			skip = op->offset + op->oldlen;
+		delta += _fdt_edit_newlen(op) - op->oldlen;
+	}
+	if (_fdt_data_size(fdt) + delta + ed->new_strings
+	    > fdt_totalsize(fdt))
+		return -FDT_ERR_NOSPACE;
+
+	/*
+	 * The unchanged runs of data between the changes (the last one
+	 * including the strings block) each move by a fixed amount. Move
+	 * those going down first, working forwards, then those going up,
+	 * working backwards, so that nothing is overwritten before it is
+	 * moved. Then fill in the gaps.
+	 */
+	base = (char *)fdt + fdt_off_dt_struct(fdt);
+	data_end = _fdt_data_size(fdt) - fdt_off_dt_struct(fdt);
+	for (op = ed->op, shift = 0, start = 0; ; op++) {
+		if ((op < end) && (op->flags & FDT_EDIT_DEAD))
+			continue;
+		len = ((op < end) ? op->offset : data_end) - start;
+		if (shift < 0)
+			memmove(base + start + shift, base + start, len);
+		if (op == end)
+			break;
+		shift += _fdt_edit_newlen(op) - op->oldlen;
+		start = op->offset + op->oldlen;
+	}
+	for (i = ed->num_ops - 1, shift = delta, start = data_end; ; i--) {
+		op = (i >= 0) ? &ed->op[i] : NULL;
+		if (op && (op->flags & FDT_EDIT_DEAD))
+			continue;
+		len = start - (op ? op->offset + op->oldlen : 0);
+		if (shift > 0)
+			memmove(base + start - len + shift, base + start - len,
+				len);
+		if (!op)
+			break;
+		shift -= _fdt_edit_newlen(op) - op->oldlen;
+		start = op->offset;
+	}
+	for (op = ed->op, shift = 0; op < end; op++) {
+		if (op->flags & FDT_EDIT_DEAD)
+			continue;
+		_fdt_edit_write(op, base + op->offset + shift);
+		shift += _fdt_edit_newlen(op) - op->oldlen;
+	}
+
+	fdt_set_size_dt_struct(fdt, fdt_size_dt_struct(fdt) + delta);
+	fdt_set_off_dt_strings(fdt, fdt_off_dt_strings(fdt) + delta);
+
+	/* Names added by dropped changes are still added, as before */
+	strtab = (char *)fdt + fdt_off_dt_strings(fdt);
+	for (op = ed->op; op < end; op++) {
+		if (!(op->flags & FDT_EDIT_NEWSTR))
+			continue;
+		memcpy(strtab + op->nameoff, op->name, op->namelen);
+		strtab[op->nameoff + op->namelen] = '\0';
+	}
+	fdt_set_size_dt_strings(fdt, fdt_size_dt_strings(fdt)
+				+ ed->new_strings);
+
+	/* Start a new session on the updated tree */
+	return fdt_edit_begin(ed, fdt, ed->op, ed->max_ops);
+}
@@ -197,16 +197,24 @@ int fdt_end_node(void *fdt)
 	return 0;
 }
 
-static int _fdt_find_add_string(void *fdt, const char *s)
+static int _fdt_find_add_string(void *fdt, struct fdt_strhash *sh,
+				const char *s)
 {
 	char *strtab = (char *)fdt + fdt_totalsize(fdt);
 	const char *p;
 	int strtabsize = fdt_size_dt_strings(fdt);
 	int len = strlen(s) + 1;
 	int struct_top, offset;
-
-	p = _fdt_find_string(strtab - strtabsize, strtabsize, s);
-	if (p)
+	int found;
+
+	/* The string table grows down from the end, so offsets are -ve */
+	found = _fdt_strhash_find(sh, fdt, strtab - strtabsize, strtabsize,
+				  strtab, s, len, &p);
+	if (found < 0) {
+		p = _fdt_find_string(strtab - strtabsize, strtabsize, s);
+		found = (p != NULL);
+	}
+	if (found)
 		return p - strtab;
 
 	/* Add it */
@@ -217,17 +225,20 @@ static int _fdt_find_add_string(void *fdt, const char *s)
 
 	memcpy(strtab + offset, s, len);
 	fdt_set_size_dt_strings(fdt, strtabsize + len);
+	_fdt_strhash_add(sh, fdt, strtabsize + len, strtab, strtab + offset,
+			 len);
 	return offset;
 }
 
-int fdt_property(void *fdt, const char *name, const void *val, int len)
+int fdt_property_strhash(void *fdt, struct fdt_strhash *sh, const char *name,
+			 const void *val, int len)
 {
 	struct fdt_property *prop;
 	int nameoff;
 
 	FDT_SW_CHECK_HEADER(fdt);
 
-	nameoff = _fdt_find_add_string(fdt, name);
+	nameoff = _fdt_find_add_string(fdt, sh, name);
 	if (nameoff == 0)
 		return -FDT_ERR_NOSPACE;
 
@@ -242,6 +253,11 @@ int fdt_property(void *fdt, const char *name, const void *val, int len)
 	return 0;
 }
 
+int fdt_property(void *fdt, const char *name, const void *val, int len)
+{
+	return fdt_property_strhash(fdt, NULL, name, val, len);
+}
+
 int fdt_finish(void *fdt)
 {
 	char *p = (char *)fdt;
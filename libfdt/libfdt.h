@@ -927,6 +927,246 @@ int fdt_address_cells(const void *fdt, int nodeoffset);
  */
 int fdt_size_cells(const void *fdt, int nodeoffset);
 
+/**********************************************************************/
+/* Read-only functions (indexed lookup)                               */
+/**********************************************************************/
+
+/* One entry in a node index, see fdt_index_build() */
+struct fdt_index_node {
+	int offset;		/* Structure block offset of node */
+	int parent;		/* Index of parent node, -1 for the root */
+	int next;		/* Next node in same name hash chain, or -1 */
+	int next_base;		/* Next node in same base-name chain, or -1 */
+};
+
+/* A node index, built by fdt_index_build() in a caller-provided buffer */
+struct fdt_index {
+	const void *fdt;		/* FDT blob which was indexed */
+	int size_dt_struct;		/* Size of structure block when indexed */
+	int num_nodes;			/* Number of nodes in the tree */
+	int hash_mask;			/* Number of hash buckets - 1 */
+	struct fdt_index_node *node;	/* Node list, in tree order */
+	int *bucket;			/* Chains hashed on parent/name */
+	int *base_bucket;		/* Chains hashed on name less unit addr */
+};
+
+/**
+ * fdt_index_size() - get the buffer size needed to index a tree
+ *
+ * @fdt:	FDT blob
+ * @return number of bytes needed for the buffer passed to
+ * fdt_index_build(), or -ve error value:
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_size(const void *fdt);
+
+/**
+ * fdt_index_build() - build an index of the nodes in a tree
+ *
+ * Looking up a path with fdt_path_offset() scans the structure block from
+ * the root for every path component. When many paths are to be looked up
+ * in a large tree this is slow. This function scans the tree once and
+ * builds hash tables mapping each (parent, name) pair to a node offset, so
+ * that the fdt_index_...() lookup functions below take time proportional
+ * to the number of path components.
+ *
+ * No memory is allocated: the index lives in @buf, which must be at least
+ * fdt_index_size() bytes. The tree must not be changed while the index is
+ * in use. The lookup functions notice if the structure block changes size
+ * (as it does with most fdt_rw.c functions) and fall back to a normal
+ * search, but it is better to rebuild the index after any change.
+ *
+ * @fdt:	FDT blob
+ * @index:	Returns the index
+ * @buf:	Buffer to hold the index
+ * @bufsize:	Size of buffer in bytes
+ * @return 0 on success, or -ve error value:
+ *	-FDT_ERR_NOSPACE, @bufsize is smaller than fdt_index_size()
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_build(const void *fdt, struct fdt_index *index, void *buf,
+		    int bufsize);
+
+/**
+ * fdt_index_subnode_offset_namelen() - find a subnode using an index
+ *
+ * This is the same as fdt_subnode_offset_namelen() but uses @index to avoid
+ * scanning the tree. If @index is NULL, or was not built for this tree,
+ * fdt_subnode_offset_namelen() is called instead.
+ *
+ * @fdt:	FDT blob
+ * @index:	Index built by fdt_index_build(), or NULL
+ * @parentoffset: Structure block offset of a node
+ * @name:	Name of the subnode to locate
+ * @namelen:	Number of characters of @name to consider
+ * @return as for fdt_subnode_offset_namelen()
+ */
+int fdt_index_subnode_offset_namelen(const void *fdt,
+				     const struct fdt_index *index,
+				     int parentoffset, const char *name,
+				     int namelen);
+
+/**
+ * fdt_index_subnode_offset() - find a subnode using an index
+ *
+ * As fdt_index_subnode_offset_namelen(), but @name is nul-terminated.
+ */
+int fdt_index_subnode_offset(const void *fdt, const struct fdt_index *index,
+			     int parentoffset, const char *name);
+
+/**
+ * fdt_index_path_offset_namelen() - find a tree node by path using an index
+ *
+ * This is the same as fdt_path_offset_namelen() but uses @index to avoid
+ * scanning the tree. If @index is NULL, or was not built for this tree,
+ * fdt_path_offset_namelen() is called instead.
+ *
+ * @fdt:	FDT blob
+ * @index:	Index built by fdt_index_build(), or NULL
+ * @path:	Full path of the node to locate, or an alias
+ * @namelen:	Number of characters of @path to consider
+ * @return as for fdt_path_offset_namelen()
+ */
+int fdt_index_path_offset_namelen(const void *fdt,
+				  const struct fdt_index *index,
+				  const char *path, int namelen);
+
+/**
+ * fdt_index_path_offset() - find a tree node by path using an index
+ *
+ * As fdt_index_path_offset_namelen(), but @path is nul-terminated.
+ */
+int fdt_index_path_offset(const void *fdt, const struct fdt_index *index,
+			  const char *path);
+
+/* One slot in a phandle cache, see fdt_phandle_cache_build() */
+struct fdt_phandle_entry {
+	uint32_t phandle;	/* Phandle value, 0 if slot is empty */
+	int offset;		/* Structure block offset of node */
+};
+
+/* A phandle cache, built by fdt_phandle_cache_build() */
+struct fdt_phandle_cache {
+	const void *fdt;		/* FDT blob cached, NULL if invalid */
+	int size_dt_struct;		/* Size of structure block when built */
+	int hash_mask;			/* Number of slots - 1 */
+	int full;			/* 1 if the phandles did not fit */
+	struct fdt_phandle_entry *entry;	/* Open-addressed hash table */
+};
+
+/**
+ * fdt_phandle_cache_size() - get the buffer size needed for a phandle cache
+ *
+ * @fdt:	FDT blob
+ * @return number of bytes needed for the buffer passed to
+ * fdt_phandle_cache_build(), or -ve error value:
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_phandle_cache_size(const void *fdt);
+
+/**
+ * fdt_phandle_cache_build() - build a cache of phandle to node offset
+ *
+ * fdt_node_offset_by_phandle() scans the whole tree on each call. This
+ * function scans it once and builds a hash table of phandles, so that
+ * fdt_node_offset_by_phandle_cache() can find a node in constant time.
+ *
+ * No memory is allocated: the cache lives in @buf, which must be at least
+ * fdt_phandle_cache_size() bytes. Any extra space is used to allow for
+ * phandles added to the tree later.
+ *
+ * The tree may be changed with the fdt_rw.c and fdt_wip.c functions while
+ * the cache is in use. Each cache hit is checked against the tree, and
+ * the cache is rebuilt when the structure block changes size or a lookup
+ * finds the cache to be out of date. This means that it is best to
+ * finish making changes before doing many lookups. If phandles added later
+ * no longer fit in @buf, lookups search the tree until the structure block
+ * changes size again.
+ *
+ * @fdt:	FDT blob
+ * @cache:	Returns the cache
+ * @buf:	Buffer to hold the cache
+ * @bufsize:	Size of buffer in bytes
+ * @return 0 on success, or -ve error value:
+ *	-FDT_ERR_NOSPACE, @bufsize is smaller than fdt_phandle_cache_size()
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_phandle_cache_build(const void *fdt, struct fdt_phandle_cache *cache,
+			    void *buf, int bufsize);
+
+/**
+ * fdt_node_offset_by_phandle_cache() - find the node with a given phandle
+ *
+ * This is the same as fdt_node_offset_by_phandle() but uses @cache to avoid
+ * scanning the tree. If @cache is NULL, fdt_node_offset_by_phandle() is
+ * called instead. The cache is updated if it is found to be out of date.
+ *
+ * @fdt:	FDT blob
+ * @cache:	Cache built by fdt_phandle_cache_build(), or NULL
+ * @phandle:	Phandle value
+ * @return as for fdt_node_offset_by_phandle()
+ */
+int fdt_node_offset_by_phandle_cache(const void *fdt,
+				     struct fdt_phandle_cache *cache,
+				     uint32_t phandle);
+
+/* Value of an unused slot in a string hash */
+#define FDT_STRHASH_EMPTY	INT32_MIN
+
+/* A string hash, set up by fdt_strhash_init() */
+struct fdt_strhash {
+	const void *fdt;	/* FDT blob whose strings are hashed */
+	int tabsize;		/* Size of string block when last updated */
+	int count;		/* Number of strings in the hash */
+	int complete;		/* 1 if all strings in the block are hashed */
+	int mask;		/* Number of slots - 1 */
+	int32_t *slot;		/* String offsets, or FDT_STRHASH_EMPTY */
+};
+
+/**
+ * fdt_strhash_init() - set up a hash of the strings in a string block
+ *
+ * Adding a property with fdt_property() or fdt_setprop() searches the whole
+ * string block for the property name, so building or editing a tree with
+ * many properties takes time proportional to the square of their number.
+ * A string hash avoids this: pass it to fdt_property_strhash() or
+ * fdt_setprop_strhash() and names are found by their hash instead.
+ *
+ * The hash is a fixed-size table of string offsets provided by the caller.
+ * It should have a few more slots than the number of distinct property
+ * names expected, rounded up to a power of two. If it fills up, lookups
+ * fall back to searching the string block.
+ *
+ * The hash is filled from the string block on first use, and again if the
+ * block is changed by other functions, or a different blob is passed in
+ * (for example after fdt_resize() or fdt_open_into()). Unlike a normal
+ * search the hash does not find names which are the tail of an existing
+ * string, so the string block may be slightly larger.
+ *
+ * @sh:		String hash to set up
+ * @slot:	Table of slots to use
+ * @num_slots:	Number of slots in @slot (only the largest power of two
+ *		that fits is used)
+ * @return 0 on success, or -FDT_ERR_NOSPACE if @num_slots is less than 2
+ */
+int fdt_strhash_init(struct fdt_strhash *sh, int32_t *slot, int num_slots);
+
 
 /**********************************************************************/
 /* Write-in-place functions                                           */
@@ -1104,6 +1344,16 @@ int fdt_add_reservemap_entry(void *fdt, uint64_t addr, uint64_t size);
 int fdt_finish_reservemap(void *fdt);
 int fdt_begin_node(void *fdt, const char *name);
 int fdt_property(void *fdt, const char *name, const void *val, int len);
+
+/**
+ * fdt_property_strhash() - add a property, using a string hash
+ *
+ * This is the same as fdt_property(), but looks up the property name
+ * using a hash set up by fdt_strhash_init(). If @sh is NULL it behaves
+ * exactly like fdt_property().
+ */
+int fdt_property_strhash(void *fdt, struct fdt_strhash *sh, const char *name,
+			 const void *val, int len);
 static inline int fdt_property_u32(void *fdt, const char *name, uint32_t val)
 {
 	fdt32_t tmp = cpu_to_fdt32(val);
@@ -1236,6 +1486,24 @@ int fdt_set_name(void *fdt, int nodeoffset, const char *name);
 int fdt_setprop(void *fdt, int nodeoffset, const char *name,
 		const void *val, int len);
 
+/**
+ * fdt_setprop_strhash - create or change a property, using a string hash
+ * @fdt: pointer to the device tree blob
+ * @sh: string hash set up by fdt_strhash_init(), or NULL
+ * @nodeoffset: offset of the node whose property to change
+ * @name: name of the property to change
+ * @val: pointer to data to set the property value to
+ * @len: length of the property value
+ *
+ * This is the same as fdt_setprop(), but if the property must be created,
+ * its name is looked up in the string block using @sh.
+ *
+ * returns:
+ *	as for fdt_setprop()
+ */
+int fdt_setprop_strhash(void *fdt, struct fdt_strhash *sh, int nodeoffset,
+			const char *name, const void *val, int len);
+
 /**
  * fdt_setprop_u32 - set a property to a 32-bit integer
  * @fdt: pointer to the device tree blob
@@ -1582,6 +1850,169 @@ int fdt_add_subnode(void *fdt, int parentoffset, const char *name);
  */
 int fdt_del_node(void *fdt, int nodeoffset);
 
+/**********************************************************************/
+/* Read-write functions (batched edits)                               */
+/**********************************************************************/
+
+/*
+ * Each of the read-write functions above moves everything after the point
+ * of change, so making many changes to a large tree is slow. An edit
+ * session instead queues up changes and then makes them all at once in a
+ * single pass over the blob.
+ */
+
+/* Types of queued operation */
+#define FDT_EDIT_SETPROP	0	/* fdt_edit_setprop() */
+#define FDT_EDIT_DELPROP	1	/* fdt_edit_delprop() */
+#define FDT_EDIT_ADD_SUBNODE	2	/* fdt_edit_add_subnode() */
+#define FDT_EDIT_DEL_NODE	3	/* fdt_edit_del_node() */
+
+/* A queued operation, all fields private to libfdt */
+struct fdt_edit_op {
+	int type;		/* FDT_EDIT_... */
+	int nodeoffset;		/* Node to change, or parent for a new node */
+	const char *name;	/* Property or node name */
+	int namelen;		/* Length of name */
+	const void *val;	/* Property value */
+	int len;		/* Length of property value */
+	int seq;		/* Position in the queue */
+	int offset;		/* Struct-block offset of the change */
+	int oldlen;		/* Number of bytes replaced at offset */
+	int nameoff;		/* String offset of property name */
+	int ref;		/* Operation holding the value to use */
+	int flags;
+};
+
+/* An edit session, set up by fdt_edit_begin() */
+struct fdt_edit {
+	void *fdt;		/* Tree being edited */
+	int size_dt_struct;	/* Size of struct block at start */
+	int size_dt_strings;	/* Size of strings block at start */
+	int new_strings;	/* Number of bytes of strings to add */
+	struct fdt_edit_op *op;	/* Queued operations */
+	int num_ops;		/* Number of queued operations */
+	int max_ops;		/* Size of op[] */
+};
+
+/**
+ * fdt_edit_begin() - start an edit session
+ *
+ * Operations are queued with fdt_edit_setprop(), fdt_edit_delprop(),
+ * fdt_edit_add_subnode() and fdt_edit_del_node(), all of which take node
+ * offsets in the tree as it is now. Nothing changes until
+ * fdt_edit_commit(), after which the tree is the same as if the
+ * operations had been done in order with fdt_setprop(), fdt_delprop(),
+ * fdt_add_subnode() and fdt_del_node(). The tree must not be changed in
+ * any other way during the session.
+ *
+ * Nodes added in the session cannot be referred to until it is
+ * committed, and a node cannot be used once it has been deleted.
+ * Property names and values are not copied, so must remain valid until
+ * fdt_edit_commit(), and must not point into the tree.
+ *
+ * Each queued operation uses one element of @op, so @max_ops limits the
+ * number of operations in a session.
+ *
+ * @ed:		Edit session to set up
+ * @fdt:	Tree to edit
+ * @op:		Space for queued operations
+ * @max_ops:	Number of elements in @op
+ * @return 0 on success, or:
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_edit_begin(struct fdt_edit *ed, void *fdt, struct fdt_edit_op *op,
+		   int max_ops);
+
+/**
+ * fdt_edit_setprop() - queue a call to fdt_setprop()
+ *
+ * @ed:		Edit session
+ * @nodeoffset:	Offset of the node whose property to change
+ * @name:	Name of the property to change
+ * @val:	Pointer to data to set the property value to
+ * @len:	Length of the property value
+ * @return 0 on success, or:
+ *	-FDT_ERR_NOSPACE, if the session has no space for more operations
+ *	-FDT_ERR_BADOFFSET, if nodeoffset did not point to an FDT_BEGIN_NODE
+ *		tag, or the node has been deleted in this session
+ */
+int fdt_edit_setprop(struct fdt_edit *ed, int nodeoffset, const char *name,
+		     const void *val, int len);
+
+/**
+ * fdt_edit_delprop() - queue a call to fdt_delprop()
+ *
+ * @ed:		Edit session
+ * @nodeoffset:	Offset of the node whose property to delete
+ * @name:	Name of the property to delete
+ * @return 0 on success, or:
+ *	-FDT_ERR_NOTFOUND, if the node has no property of that name (after
+ *		any operations already queued)
+ *	-FDT_ERR_NOSPACE, if the session has no space for more operations
+ *	-FDT_ERR_BADOFFSET, if nodeoffset did not point to an FDT_BEGIN_NODE
+ *		tag, or the node has been deleted in this session
+ */
+int fdt_edit_delprop(struct fdt_edit *ed, int nodeoffset, const char *name);
+
+/**
+ * fdt_edit_add_subnode() - queue a call to fdt_add_subnode()
+ *
+ * The new node's offset is not known until the session is committed.
+ *
+ * @ed:		Edit session
+ * @parentoffset: Offset of the parent node
+ * @name:	Name of the subnode to add
+ * @return 0 on success, or:
+ *	-FDT_ERR_EXISTS, if the node already has a subnode of the given name
+ *		(after any operations already queued)
+ *	-FDT_ERR_NOSPACE, if the session has no space for more operations
+ *	-FDT_ERR_BADOFFSET, if parentoffset did not point to an
+ *		FDT_BEGIN_NODE tag, or the node has been deleted in this
+ *		session
+ */
+int fdt_edit_add_subnode(struct fdt_edit *ed, int parentoffset,
+			 const char *name);
+
+/**
+ * fdt_edit_del_node() - queue a call to fdt_del_node()
+ *
+ * Changes already queued inside the node are dropped, but any property
+ * names they add are still added to the strings block, as they would be
+ * by fdt_setprop().
+ *
+ * @ed:		Edit session
+ * @nodeoffset:	Offset of the node to delete
+ * @return 0 on success, or:
+ *	-FDT_ERR_NOSPACE, if the session has no space for more operations
+ *	-FDT_ERR_BADOFFSET, if nodeoffset did not point to an FDT_BEGIN_NODE
+ *		tag, or the node has already been deleted in this session
+ */
+int fdt_edit_del_node(struct fdt_edit *ed, int nodeoffset);
+
+/**
+ * fdt_edit_commit() - make the changes queued in an edit session
+ *
+ * This makes all the queued changes in one pass over the tree. Either all
+ * of them are made, or (on error) none. Afterwards a new session is
+ * started on the updated tree, with no operations queued.
+ *
+ * @ed:		Edit session
+ * @return 0 on success, or:
+ *	-FDT_ERR_NOSPACE, if there is insufficient free space in the blob
+ *	-FDT_ERR_BADSTATE, if the tree was changed outside the session
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_edit_commit(struct fdt_edit *ed);
+
 /**********************************************************************/
 /* Debugging / informational functions                                */
 /**********************************************************************/
@@ -66,6 +66,7 @@ int _fdt_check_node_offset(const void *fdt, int offset);
 int _fdt_check_prop_offset(const void *fdt, int offset);
 const char *_fdt_find_string(const char *strtab, int tabsize, const char *s);
 int _fdt_node_end_offset(void *fdt, int nodeoffset);
+int _fdt_nodename_eq(const void *fdt, int offset, const char *s, int len);
 
 static inline const void *_fdt_offset_ptr(const void *fdt, int offset)
 {
@@ -92,4 +93,38 @@ static inline struct fdt_reserve_entry *_fdt_mem_rsv_w(void *fdt, int n)
 
 #define FDT_SW_MAGIC		(~FDT_MAGIC)
 
+/* 32-bit FNV-1a hash, used by the lookup tables in fdt_index.c */
+static inline uint32_t _fdt_hash(uint32_t hash, const char *s, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)s[i]) * 16777619;
+	return hash;
+}
+
+#define FDT_HASH_INIT		2166136261U
+
+/**
+ * _fdt_strhash_find() - look up a string in a string block using a hash
+ *
+ * @sh: String hash, or NULL
+ * @fdt: FDT blob containing the string block
+ * @strtab: Start of the string block
+ * @tabsize: Size of the string block
+ * @base: Base pointer for the offsets held in the hash
+ * @s: String to look for
+ * @len: Length of @s including its nul terminator
+ * @pp: Returns a pointer to the string, if found
+ * @return 1 if found, 0 if not present, -1 if the caller must search the
+ * block itself
+ */
+int _fdt_strhash_find(struct fdt_strhash *sh, const void *fdt,
+		      const char *strtab, int tabsize, const char *base,
+		      const char *s, int len, const char **pp);
+
+/* Record that the string at @p was added to a string block */
+void _fdt_strhash_add(struct fdt_strhash *sh, const void *fdt, int tabsize,
+		      const char *base, const char *p, int len);
+
 #endif /* _LIBFDT_INTERNAL_H */
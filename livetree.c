@@ -20,6 +20,486 @@
 
 #include "dtc.h"
 
+/*
+ * The phandle registry maps each phandle in use in a tree to its node, so
+ * that neither looking up a phandle nor finding a free one needs to walk
+ * the whole tree. It is built on first use, then kept up to date as
+ * phandles are assigned and nodes are deleted. Adding nodes discards it,
+ * to be rebuilt when next needed.
+ */
+struct phandle_registry {
+	struct node *root;	/* tree this describes, or NULL if none */
+	struct node **slot;	/* open addressed by phandle, NULL if empty */
+	unsigned int mask;	/* number of slots - 1 */
+	unsigned int count;	/* number of slots in use */
+};
+
+static struct phandle_registry phandles;
+
+static unsigned int phandle_hash(cell_t phandle)
+{
+	return phandle * 2654435761U;
+}
+
+/* Find the slot holding a phandle, or the empty slot where it would go */
+static unsigned int phandle_find(cell_t phandle)
+{
+	unsigned int i = phandle_hash(phandle) & phandles.mask;
+
+	while (phandles.slot[i] && (phandles.slot[i]->phandle != phandle))
+		i = (i + 1) & phandles.mask;
+
+	return i;
+}
+
+static void phandle_insert(struct node *node)
+{
+	struct node **old = phandles.slot;
+	unsigned int i, size = phandles.mask + 1;
+
+	if ((phandles.count + 1) * 2 > size) {
+		phandles.slot = xmalloc(2 * size * sizeof(*phandles.slot));
+		memset(phandles.slot, 0, 2 * size * sizeof(*phandles.slot));
+		phandles.mask = 2 * size - 1;
+		for (i = 0; i < size; i++)
+			if (old[i])
+				phandles.slot[phandle_find(old[i]->phandle)] =
+					old[i];
+		free(old);
+	}
+
+	i = phandle_find(node->phandle);
+	if (!phandles.slot[i]) {
+		phandles.slot[i] = node;
+		phandles.count++;
+	}
+}
+
+static void phandle_remove(struct node *node)
+{
+	unsigned int i, j, k;
+
+	i = phandle_find(node->phandle);
+	if (phandles.slot[i] != node)
+		return;
+	phandles.slot[i] = NULL;
+	phandles.count--;
+
+	/* Move back any later entries which can no longer be reached */
+	for (j = (i + 1) & phandles.mask; phandles.slot[j];
+	     j = (j + 1) & phandles.mask) {
+		k = phandle_hash(phandles.slot[j]->phandle) & phandles.mask;
+		if (((j - k) & phandles.mask) >= ((j - i) & phandles.mask)) {
+			phandles.slot[i] = phandles.slot[j];
+			phandles.slot[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+static void phandle_register_tree(struct node *tree)
+{
+	struct node *child;
+
+	if ((tree->phandle != 0) && (tree->phandle != -1))
+		phandle_insert(tree);
+
+	for_each_child(tree, child)
+		phandle_register_tree(child);
+}
+
+static void phandle_registry_init(struct node *root)
+{
+	if (phandles.root == root)
+		return;
+
+	free(phandles.slot);
+	phandles.slot = xmalloc(64 * sizeof(*phandles.slot));
+	memset(phandles.slot, 0, 64 * sizeof(*phandles.slot));
+	phandles.mask = 63;
+	phandles.count = 0;
+	phandles.root = root;
+
+	if (!root->deleted)
+		phandle_register_tree(root);
+}
+
+/*
+ * The label index maps each label in a tree to the nodes, properties and
+ * property values carrying it, so that references can be resolved without
+ * searching the whole tree. It is built by build_label_index() once the
+ * tree has been parsed; before that, lookups search the tree.
+ *
+ * Entries are held in tree order, so a lookup returns the same match as
+ * a search would, even when a label is duplicated. Deleted labels,
+ * properties and nodes stay in the index but are skipped by lookups.
+ * Anything which adds labels marks the index stale, so that it is rebuilt
+ * on the next lookup.
+ */
+enum label_kind {
+	LABEL_NODE,
+	LABEL_PROP,
+	LABEL_MARKER,
+};
+
+struct label_entry {
+	enum label_kind kind;
+	const char *label;
+	struct node *node;
+	struct property *prop;	/* NULL for LABEL_NODE */
+	struct label *l;	/* NULL for LABEL_MARKER */
+	struct marker *m;	/* NULL unless LABEL_MARKER */
+	int next;		/* next entry in the same bucket, or -1 */
+};
+
+struct label_index {
+	struct node *root;	/* tree indexed, or NULL if none */
+	bool stale;		/* rebuild before the next lookup */
+	struct label_entry *entry;
+	int count, max;
+	int *bucket;		/* first entry in each bucket, or -1 */
+	unsigned int mask;	/* number of buckets - 1 */
+};
+
+static struct label_index label_index;
+
+static void label_index_add(enum label_kind kind, const char *label,
+			    struct node *node, struct property *prop,
+			    struct label *l, struct marker *m)
+{
+	struct label_entry *e;
+
+	if (label_index.count == label_index.max) {
+		label_index.max = label_index.max ? 2 * label_index.max : 64;
+		label_index.entry = xrealloc(label_index.entry, label_index.max
+					     * sizeof(*label_index.entry));
+	}
+	e = &label_index.entry[label_index.count++];
+	e->kind = kind;
+	e->label = label;
+	e->node = node;
+	e->prop = prop;
+	e->l = l;
+	e->m = m;
+}
+
+static void label_index_add_tree(struct node *tree)
+{
+	struct property *prop;
+	struct node *child;
+	struct marker *m;
+	struct label *l;
+
+	for_each_label(tree->labels, l)
+		label_index_add(LABEL_NODE, l->label, tree, NULL, l, NULL);
+
+	for_each_property(tree, prop) {
+		for_each_label(prop->labels, l)
+			label_index_add(LABEL_PROP, l->label, tree, prop, l,
+					NULL);
+		m = prop->val.markers;
+		for_each_marker_of_type(m, LABEL)
+			label_index_add(LABEL_MARKER, m->ref, tree, prop, NULL,
+					m);
+	}
+
+	for_each_child(tree, child)
+		label_index_add_tree(child);
+}
+
+void build_label_index(struct node *tree)
+{
+	unsigned int size, b;
+	int i;
+
+	label_index.root = tree;
+	label_index.stale = false;
+	label_index.count = 0;
+	label_index_add_tree(tree);
+
+	for (size = 64; size < 2 * label_index.count; size *= 2)
+		;
+	free(label_index.bucket);
+	label_index.bucket = xmalloc(size * sizeof(*label_index.bucket));
+	memset(label_index.bucket, 0xff, size * sizeof(*label_index.bucket));
+	label_index.mask = size - 1;
+
+	/* Add to the front of each bucket, last first, to keep tree order */
+	for (i = label_index.count - 1; i >= 0; i--) {
+		const char *label = label_index.entry[i].label;
+
+		b = util_hash(label, strlen(label)) & label_index.mask;
+		label_index.entry[i].next = label_index.bucket[b];
+		label_index.bucket[b] = i;
+	}
+}
+
+void invalidate_label_index(void)
+{
+	label_index.stale = true;
+}
+
+/*
+ * Nodes with many children or properties get a name index for each list,
+ * built the first time the list is searched by name. This maps each name
+ * to the items with that name, in list order, and also records the last
+ * item so that adding another doesn't need to walk the list. Code which
+ * rearranges a node's lists must call invalidate_name_index().
+ */
+#define NAME_INDEX_THRESHOLD	16
+
+struct name_entry {
+	const char *name;
+	void *item;
+	int next;		/* next entry with the same name, or -1 */
+	int last;		/* last entry with this name (first entry only) */
+};
+
+struct name_index {
+	struct name_entry *entry;
+	int count, max;
+	int *slot;		/* first entry for each name, or -1 if empty */
+	unsigned int mask;	/* number of slots - 1 */
+	int names;		/* number of slots in use */
+	void *tail;		/* last item in the list */
+};
+
+/* Find the slot for a name, or the empty slot where it would go */
+static unsigned int name_index_find(struct name_index *idx, const char *name)
+{
+	unsigned int i = util_hash(name, strlen(name)) & idx->mask;
+
+	while ((idx->slot[i] >= 0)
+	       && !streq(idx->entry[idx->slot[i]].name, name))
+		i = (i + 1) & idx->mask;
+
+	return i;
+}
+
+static void name_index_add(struct name_index *idx, const char *name,
+			   void *item)
+{
+	struct name_entry *e;
+	unsigned int i, size;
+	int *old, n;
+
+	if (idx->count == idx->max) {
+		idx->max *= 2;
+		idx->entry = xrealloc(idx->entry,
+				      idx->max * sizeof(*idx->entry));
+	}
+	n = idx->count++;
+	e = &idx->entry[n];
+	e->name = name;
+	e->item = item;
+	e->next = -1;
+	e->last = n;
+	idx->tail = item;
+
+	size = idx->mask + 1;
+	if ((idx->names + 1) * 2 > size) {
+		old = idx->slot;
+		idx->slot = xmalloc(2 * size * sizeof(*idx->slot));
+		memset(idx->slot, 0xff, 2 * size * sizeof(*idx->slot));
+		idx->mask = 2 * size - 1;
+		for (i = 0; i < size; i++)
+			if (old[i] >= 0)
+				idx->slot[name_index_find(idx,
+					idx->entry[old[i]].name)] = old[i];
+		free(old);
+	}
+
+	i = name_index_find(idx, name);
+	if (idx->slot[i] < 0) {
+		idx->slot[i] = n;
+		idx->names++;
+	} else {
+		e = &idx->entry[idx->slot[i]];
+		idx->entry[e->last].next = n;
+		e->last = n;
+	}
+}
+
+static struct name_index *name_index_new(void)
+{
+	struct name_index *idx = xmalloc(sizeof(*idx));
+
+	idx->max = 2 * NAME_INDEX_THRESHOLD;
+	idx->entry = xmalloc(idx->max * sizeof(*idx->entry));
+	idx->count = 0;
+	idx->mask = 4 * NAME_INDEX_THRESHOLD - 1;
+	idx->slot = xmalloc((idx->mask + 1) * sizeof(*idx->slot));
+	memset(idx->slot, 0xff, (idx->mask + 1) * sizeof(*idx->slot));
+	idx->names = 0;
+	idx->tail = NULL;
+
+	return idx;
+}
+
+static void name_index_free(struct name_index *idx)
+{
+	if (idx) {
+		free(idx->entry);
+		free(idx->slot);
+		free(idx);
+	}
+}
+
+/* Return the first entry with a name, or -1 if there is none */
+static int name_index_first(struct name_index *idx, const char *name)
+{
+	return idx->slot[name_index_find(idx, name)];
+}
+
+void invalidate_name_index(struct node *node)
+{
+	name_index_free(node->child_index);
+	name_index_free(node->prop_index);
+	node->child_index = NULL;
+	node->prop_index = NULL;
+}
+
+/* Return the index of a node's children, if it has enough to need one */
+static struct name_index *child_index(struct node *node)
+{
+	struct node *child;
+	int n = 0;
+
+	if (node->child_index)
+		return node->child_index;
+
+	for_each_child_withdel(node, child)
+		if (++n > NAME_INDEX_THRESHOLD)
+			break;
+	if (n <= NAME_INDEX_THRESHOLD)
+		return NULL;
+
+	node->child_index = name_index_new();
+	for_each_child_withdel(node, child)
+		name_index_add(node->child_index, child->name, child);
+
+	return node->child_index;
+}
+
+/* Return the index of a node's properties, if it has enough to need one */
+static struct name_index *prop_index(struct node *node)
+{
+	struct property *prop;
+	int n = 0;
+
+	if (node->prop_index)
+		return node->prop_index;
+
+	for_each_property_withdel(node, prop)
+		if (++n > NAME_INDEX_THRESHOLD)
+			break;
+	if (n <= NAME_INDEX_THRESHOLD)
+		return NULL;
+
+	node->prop_index = name_index_new();
+	for_each_property_withdel(node, prop)
+		name_index_add(node->prop_index, prop->name, prop);
+
+	return node->prop_index;
+}
+
+/* Find the first child with a name, skipping deleted ones unless @withdel */
+static struct node *find_child(struct node *node, const char *name,
+			       bool withdel)
+{
+	struct name_index *idx = child_index(node);
+	struct node *child;
+	int i;
+
+	if (!idx) {
+		for_each_child_withdel(node, child)
+			if ((withdel || !child->deleted)
+			    && streq(child->name, name))
+				return child;
+		return NULL;
+	}
+
+	for (i = name_index_first(idx, name); i >= 0; i = idx->entry[i].next) {
+		child = idx->entry[i].item;
+		if (withdel || !child->deleted)
+			return child;
+	}
+
+	return NULL;
+}
+
+/* Find the first property with a name, as find_child() */
+static struct property *find_property(struct node *node, const char *name,
+				      bool withdel)
+{
+	struct name_index *idx = prop_index(node);
+	struct property *prop;
+	int i;
+
+	if (!idx) {
+		for_each_property_withdel(node, prop)
+			if ((withdel || !prop->deleted)
+			    && streq(prop->name, name))
+				return prop;
+		return NULL;
+	}
+
+	for (i = name_index_first(idx, name); i >= 0; i = idx->entry[i].next) {
+		prop = idx->entry[i].item;
+		if (withdel || !prop->deleted)
+			return prop;
+	}
+
+	return NULL;
+}
+
+/* Return the entry after @item in the index with the same name, or NULL */
+static void *name_index_next(struct name_index *idx, const char *name,
+			     void *item)
+{
+	int i;
+
+	for (i = name_index_first(idx, name); i >= 0; i = idx->entry[i].next)
+		if (idx->entry[i].item == item)
+			break;
+
+	if ((i < 0) || (idx->entry[i].next < 0))
+		return NULL;
+	return idx->entry[idx->entry[i].next].item;
+}
+
+struct node *get_duplicate_subnode(struct node *node, struct node *child)
+{
+	struct name_index *idx = child_index(node);
+	struct node *child2;
+
+	if (idx)
+		return name_index_next(idx, child->name, child);
+
+	for (child2 = child->next_sibling; child2;
+	     child2 = child2->next_sibling)
+		if (streq(child->name, child2->name))
+			return child2;
+
+	return NULL;
+}
+
+struct property *get_duplicate_property(struct node *node,
+					struct property *prop)
+{
+	struct name_index *idx = prop_index(node);
+	struct property *prop2;
+
+	if (idx)
+		return name_index_next(idx, prop->name, prop);
+
+	for (prop2 = prop->next; prop2; prop2 = prop2->next)
+		if (streq(prop->name, prop2->name))
+			return prop2;
+
+	return NULL;
+}
+
 /*
  * Tree building functions
  */
@@ -28,6 +508,8 @@ void add_label(struct label **labels, char *label)
 {
 	struct label *new;
 
+	invalidate_label_index();
+
 	/* Make sure the label isn't already there */
 	for_each_label_withdel(*labels, new)
 		if (streq(new->label, label)) {
@@ -35,8 +517,7 @@ void add_label(struct label **labels, char *label)
 			return;
 		}
 
-	new = xmalloc(sizeof(*new));
-	memset(new, 0, sizeof(*new));
+	new = arena_alloc(sizeof(*new));
 	new->label = label;
 	new->next = *labels;
 	*labels = new;
@@ -52,9 +533,7 @@ void delete_labels(struct label **labels)
 
 struct property *build_property(char *name, struct data val)
 {
-	struct property *new = xmalloc(sizeof(*new));
-
-	memset(new, 0, sizeof(*new));
+	struct property *new = arena_alloc(sizeof(*new));
 
 	new->name = name;
 	new->val = val;
@@ -64,9 +543,7 @@ struct property *build_property(char *name, struct data val)
 
 struct property *build_property_delete(char *name)
 {
-	struct property *new = xmalloc(sizeof(*new));
-
-	memset(new, 0, sizeof(*new));
+	struct property *new = arena_alloc(sizeof(*new));
 
 	new->name = name;
 	new->deleted = 1;
@@ -99,11 +576,9 @@ struct property *reverse_properties(struct property *first)
 
 struct node *build_node(struct property *proplist, struct node *children)
 {
-	struct node *new = xmalloc(sizeof(*new));
+	struct node *new = arena_alloc(sizeof(*new));
 	struct node *child;
 
-	memset(new, 0, sizeof(*new));
-
 	new->proplist = reverse_properties(proplist);
 	new->children = children;
 
@@ -116,9 +591,7 @@ struct node *build_node(struct property *proplist, struct node *children)
 
 struct node *build_node_delete(void)
 {
-	struct node *new = xmalloc(sizeof(*new));
-
-	memset(new, 0, sizeof(*new));
+	struct node *new = arena_alloc(sizeof(*new));
 
 	new->deleted = 1;
 
@@ -134,12 +607,62 @@ struct node *name_node(struct node *node, char *name)
 	return node;
 }
 
+static struct label *copy_labels(struct label *labels)
+{
+	struct label *l, *new = NULL, **lp = &new;
+
+	for_each_label_withdel(labels, l) {
+		*lp = arena_alloc(sizeof(**lp));
+		(*lp)->deleted = l->deleted;
+		(*lp)->label = arena_strdup(l->label);
+		lp = &(*lp)->next;
+	}
+
+	return new;
+}
+
+/*
+ * Copy a node and everything below it, as built by the parser: that is,
+ * before it has been merged into a tree.
+ */
+struct node *copy_node(struct node *node)
+{
+	struct node *new = arena_alloc(sizeof(*new));
+	struct node *child, **cp = &new->children;
+	struct property *prop, **pp = &new->proplist;
+
+	new->deleted = node->deleted;
+	if (node->name)
+		new->name = arena_strdup(node->name);
+	new->labels = copy_labels(node->labels);
+
+	for_each_property_withdel(node, prop) {
+		*pp = arena_alloc(sizeof(**pp));
+		(*pp)->deleted = prop->deleted;
+		(*pp)->name = arena_strdup(prop->name);
+		(*pp)->val = data_copy(prop->val);
+		(*pp)->labels = copy_labels(prop->labels);
+		pp = &(*pp)->next;
+	}
+
+	for_each_child_withdel(node, child) {
+		*cp = copy_node(child);
+		(*cp)->parent = new;
+		cp = &(*cp)->next_sibling;
+	}
+
+	return new;
+}
+
 struct node *merge_nodes(struct node *old_node, struct node *new_node)
 {
 	struct property *new_prop, *old_prop;
 	struct node *new_child, *old_child;
 	struct label *l;
 
+	/* The new node's lists are about to be taken apart */
+	invalidate_name_index(new_node);
+
 	old_node->deleted = 0;
 
 	/* Add new node labels to old node */
@@ -156,23 +679,22 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 		if (new_prop->deleted) {
 			delete_property_by_name(old_node, new_prop->name);
-			free(new_prop);
+			arena_free(new_prop);
 			continue;
 		}
 
 		/* Look for a collision, set new value if there is */
-		for_each_property_withdel(old_node, old_prop) {
-			if (streq(old_prop->name, new_prop->name)) {
-				/* Add new labels to old property */
-				for_each_label_withdel(new_prop->labels, l)
-					add_label(&old_prop->labels, l->label);
-
-				old_prop->val = new_prop->val;
-				old_prop->deleted = 0;
-				free(new_prop);
-				new_prop = NULL;
-				break;
-			}
+		old_prop = find_property(old_node, new_prop->name, true);
+		if (old_prop) {
+			/* Add new labels to old property */
+			for_each_label_withdel(new_prop->labels, l)
+				add_label(&old_prop->labels, l->label);
+
+			old_prop->val = new_prop->val;
+			old_prop->deleted = 0;
+			invalidate_label_index();
+			arena_free(new_prop);
+			new_prop = NULL;
 		}
 
 		/* if no collision occurred, add property to the old node. */
@@ -191,17 +713,15 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 		if (new_child->deleted) {
 			delete_node_by_name(old_node, new_child->name);
-			free(new_child);
+			arena_free(new_child);
 			continue;
 		}
 
 		/* Search for a collision.  Merge if there is */
-		for_each_child_withdel(old_node, old_child) {
-			if (streq(old_child->name, new_child->name)) {
-				merge_nodes(old_child, new_child);
-				new_child = NULL;
-				break;
-			}
+		old_child = find_child(old_node, new_child->name, true);
+		if (old_child) {
+			merge_nodes(old_child, new_child);
+			new_child = NULL;
 		}
 
 		/* if no collision occured, add child to the old node. */
@@ -211,7 +731,7 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 	/* The new node contents are now merged into the old node.  Free
 	 * the new node. */
-	free(new_node);
+	arena_free(new_node);
 
 	return old_node;
 }
@@ -227,9 +747,23 @@ struct node *chain_node(struct node *first, struct node *list)
 void add_property(struct node *node, struct property *prop)
 {
 	struct property **p;
+	struct marker *m = prop->val.markers;
+	struct name_index *idx;
+
+	if (prop->labels)
+		invalidate_label_index();
+	for_each_marker_of_type(m, LABEL)
+		invalidate_label_index();
 
 	prop->next = NULL;
 
+	idx = prop_index(node);
+	if (idx) {
+		((struct property *)idx->tail)->next = prop;
+		name_index_add(idx, prop->name, prop);
+		return;
+	}
+
 	p = &node->proplist;
 	while (*p)
 		p = &((*p)->next);
@@ -239,15 +773,10 @@ void add_property(struct node *node, struct property *prop)
 
 void delete_property_by_name(struct node *node, char *name)
 {
-	struct property *prop = node->proplist;
+	struct property *prop = find_property(node, name, true);
 
-	while (prop) {
-		if (!strcmp(prop->name, name)) {
-			delete_property(prop);
-			return;
-		}
-		prop = prop->next;
-	}
+	if (prop)
+		delete_property(prop);
 }
 
 void delete_property(struct property *prop)
@@ -258,11 +787,24 @@ void delete_property(struct property *prop)
 
 void add_child(struct node *parent, struct node *child)
 {
+	struct name_index *idx;
 	struct node **p;
 
+	/* Neither the phandle registry nor the label index covers the
+	 * new nodes */
+	phandles.root = NULL;
+	invalidate_label_index();
+
 	child->next_sibling = NULL;
 	child->parent = parent;
 
+	idx = child_index(parent);
+	if (idx) {
+		((struct node *)idx->tail)->next_sibling = child;
+		name_index_add(idx, child->name, child);
+		return;
+	}
+
 	p = &parent->children;
 	while (*p)
 		p = &((*p)->next_sibling);
@@ -272,15 +814,10 @@ void add_child(struct node *parent, struct node *child)
 
 void delete_node_by_name(struct node *parent, char *name)
 {
-	struct node *node = parent->children;
+	struct node *node = find_child(parent, name, true);
 
-	while (node) {
-		if (!strcmp(node->name, name)) {
-			delete_node(node);
-			return;
-		}
-		node = node->next_sibling;
-	}
+	if (node)
+		delete_node(node);
 }
 
 void delete_node(struct node *node)
@@ -288,6 +825,9 @@ void delete_node(struct node *node)
 	struct property *prop;
 	struct node *child;
 
+	if (phandles.root)
+		phandle_remove(node);
+
 	node->deleted = 1;
 	for_each_child(node, child)
 		delete_node(child);
@@ -298,9 +838,7 @@ void delete_node(struct node *node)
 
 struct reserve_info *build_reserve_entry(uint64_t address, uint64_t size)
 {
-	struct reserve_info *new = xmalloc(sizeof(*new));
-
-	memset(new, 0, sizeof(*new));
+	struct reserve_info *new = arena_alloc(sizeof(*new));
 
 	new->re.address = address;
 	new->re.size = size;
@@ -362,13 +900,7 @@ const char *get_unitname(struct node *node)
 
 struct property *get_property(struct node *node, const char *propname)
 {
-	struct property *prop;
-
-	for_each_property(node, prop)
-		if (streq(prop->name, propname))
-			return prop;
-
-	return NULL;
+	return find_property(node, propname, false);
 }
 
 cell_t propval_cell(struct property *prop)
@@ -377,8 +909,9 @@ cell_t propval_cell(struct property *prop)
 	return fdt32_to_cpu(*((cell_t *)prop->val.val));
 }
 
-struct property *get_property_by_label(struct node *tree, const char *label,
-				       struct node **node)
+static struct property *search_property_by_label(struct node *tree,
+						 const char *label,
+						 struct node **node)
 {
 	struct property *prop;
 	struct node *c;
@@ -394,7 +927,7 @@ struct property *get_property_by_label(struct node *tree, const char *label,
 	}
 
 	for_each_child(tree, c) {
-		prop = get_property_by_label(c, label, node);
+		prop = search_property_by_label(c, label, node);
 		if (prop)
 			return prop;
 	}
@@ -403,8 +936,9 @@ struct property *get_property_by_label(struct node *tree, const char *label,
 	return NULL;
 }
 
-struct marker *get_marker_label(struct node *tree, const char *label,
-				struct node **node, struct property **prop)
+static struct marker *search_marker_label(struct node *tree, const char *label,
+					  struct node **node,
+					  struct property **prop)
 {
 	struct marker *m;
 	struct property *p;
@@ -421,7 +955,7 @@ struct marker *get_marker_label(struct node *tree, const char *label,
 	}
 
 	for_each_child(tree, c) {
-		m = get_marker_label(c, label, node, prop);
+		m = search_marker_label(c, label, node, prop);
 		if (m)
 			return m;
 	}
@@ -433,13 +967,7 @@ struct marker *get_marker_label(struct node *tree, const char *label,
 
 struct node *get_subnode(struct node *node, const char *nodename)
 {
-	struct node *child;
-
-	for_each_child(node, child)
-		if (streq(child->name, nodename))
-			return child;
-
-	return NULL;
+	return find_child(node, nodename, false);
 }
 
 struct node *get_node_by_path(struct node *tree, const char *path)
@@ -468,19 +996,18 @@ struct node *get_node_by_path(struct node *tree, const char *path)
 	return NULL;
 }
 
-struct node *get_node_by_label(struct node *tree, const char *label)
+static struct node *search_node_by_label(struct node *tree,
+					 const char *label)
 {
 	struct node *child, *node;
 	struct label *l;
 
-	assert(label && (strlen(label) > 0));
-
 	for_each_label(tree->labels, l)
 		if (streq(l->label, label))
 			return tree;
 
 	for_each_child(tree, child) {
-		node = get_node_by_label(child, label);
+		node = search_node_by_label(child, label);
 		if (node)
 			return node;
 	}
@@ -488,25 +1015,85 @@ struct node *get_node_by_label(struct node *tree, const char *label)
 	return NULL;
 }
 
-struct node *get_node_by_phandle(struct node *tree, cell_t phandle)
+/* Find the first live entry for a label, or NULL if the tree isn't indexed */
+static struct label_entry *label_index_find(struct node *tree,
+					    enum label_kind kind,
+					    const char *label, bool *indexed)
 {
-	struct node *child, *node;
+	struct label_entry *e;
+	int i;
+
+	*indexed = (label_index.root == tree);
+	if (!*indexed)
+		return NULL;
+	if (label_index.stale)
+		build_label_index(tree);
+
+	i = label_index.bucket[util_hash(label, strlen(label))
+			       & label_index.mask];
+	for (; i >= 0; i = e->next) {
+		e = &label_index.entry[i];
+		if ((e->kind != kind) || !streq(e->label, label))
+			continue;
+		if (e->node->deleted || (e->prop && e->prop->deleted)
+		    || (e->l && e->l->deleted))
+			continue;
+		return e;
+	}
 
-	assert((phandle != 0) && (phandle != -1));
+	return NULL;
+}
 
-	if (tree->phandle == phandle) {
-		if (tree->deleted)
-			return NULL;
-		return tree;
-	}
+struct node *get_node_by_label(struct node *tree, const char *label)
+{
+	struct label_entry *e;
+	bool indexed;
 
-	for_each_child(tree, child) {
-		node = get_node_by_phandle(child, phandle);
-		if (node)
-			return node;
-	}
+	assert(label && (strlen(label) > 0));
 
-	return NULL;
+	e = label_index_find(tree, LABEL_NODE, label, &indexed);
+	if (!indexed)
+		return search_node_by_label(tree, label);
+
+	return e ? e->node : NULL;
+}
+
+struct property *get_property_by_label(struct node *tree, const char *label,
+				       struct node **node)
+{
+	struct label_entry *e;
+	bool indexed;
+
+	e = label_index_find(tree, LABEL_PROP, label, &indexed);
+	if (!indexed)
+		return search_property_by_label(tree, label, node);
+
+	*node = e ? e->node : NULL;
+	return e ? e->prop : NULL;
+}
+
+struct marker *get_marker_label(struct node *tree, const char *label,
+				struct node **node, struct property **prop)
+{
+	struct label_entry *e;
+	bool indexed;
+
+	e = label_index_find(tree, LABEL_MARKER, label, &indexed);
+	if (!indexed)
+		return search_marker_label(tree, label, node, prop);
+
+	*node = e ? e->node : NULL;
+	*prop = e ? e->prop : NULL;
+	return e ? e->m : NULL;
+}
+
+struct node *get_node_by_phandle(struct node *tree, cell_t phandle)
+{
+	assert((phandle != 0) && (phandle != -1));
+
+	phandle_registry_init(tree);
+
+	return phandles.slot[phandle_find(phandle)];
 }
 
 struct node *get_node_by_ref(struct node *tree, const char *ref)
@@ -519,9 +1106,56 @@ struct node *get_node_by_ref(struct node *tree, const char *ref)
 		return get_node_by_label(tree, ref);
 }
 
+void set_node_phandle(struct node *root, struct node *node, cell_t phandle)
+{
+	if (phandles.root == root)
+		phandle_remove(node);
+
+	node->phandle = phandle;
+
+	if (phandles.root == root)
+		phandle_insert(node);
+}
+
+static void index_nodes(struct node *tree)
+{
+	struct node *child;
+
+	child_index(tree);
+	prop_index(tree);
+	for_each_child(tree, child)
+		index_nodes(child);
+}
+
+/*
+ * Bring all of a tree's lookup indexes up to date, so that the lookup
+ * functions do not change anything. The tree can then be searched from
+ * several threads at once, as long as none of them modifies it.
+ */
+void index_tree(struct node *tree)
+{
+	if ((label_index.root == tree) && label_index.stale)
+		build_label_index(tree);
+	phandle_registry_init(tree);
+	index_nodes(tree);
+}
+
+static cell_t next_phandle = 1;	/* where to start looking for a free one */
+
+/*
+ * Forget any trees seen so far, since their memory may be reused for the
+ * next one, and start allocating phandles from the beginning again
+ */
+void reset_trees(void)
+{
+	phandles.root = NULL;
+	label_index.root = NULL;
+	next_phandle = 1;
+}
+
 cell_t get_node_phandle(struct node *root, struct node *node)
 {
-	static cell_t phandle = 1; /* FIXME: ick, static local */
+	cell_t phandle = next_phandle;
 
 	if ((node->phandle != 0) && (node->phandle != -1))
 		return node->phandle;
@@ -529,7 +1163,8 @@ cell_t get_node_phandle(struct node *root, struct node *node)
 	while (get_node_by_phandle(root, phandle))
 		phandle++;
 
-	node->phandle = phandle;
+	next_phandle = phandle;
+	set_node_phandle(root, node, phandle);
 
 	if (!get_property(node, "linux,phandle")
 	    && (phandle_format & PHANDLE_LEGACY))
@@ -700,6 +1335,7 @@ static void sort_node(struct node *node)
 
 	sort_properties(node);
 	sort_subnodes(node);
+	invalidate_name_index(node);
 	for_each_child_withdel(node, c)
 		sort_node(c);
 }
@@ -708,4 +1344,5 @@ void sort_tree(struct boot_info *bi)
 {
 	sort_reserve_entries(bi);
 	sort_node(bi->dt);
+	invalidate_label_index();
 }
@@ -0,0 +1,677 @@
+/*
+ * Precompiled include files
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *                                                                   USA
+ */
+
+#include <sys/stat.h>
+
+#include "dtc.h"
+#include "srcpos.h"
+#include "version_gen.h"
+
+/*
+ * dtc --precompile writes the fragment for an include file (see
+ * parse_fragment()) to a file: its statements, with their nodes,
+ * properties, labels, markers for references, deletions and source
+ * positions. When the include file "x.dtsi" is used as a fragment and
+ * "x.dtsi" PRECOMPILED_SUFFIX exists, the fragment is loaded from that
+ * rather than parsed. The file is mapped into memory, and names and values
+ * are used where they lie in it.
+ *
+ * A precompiled file is only used if it was written by this version of dtc
+ * and every file it was made from still has the same contents, according
+ * to a hash of each one. If it includes other files, the search path must
+ * also be the same, or those includes might now find other files.
+ *
+ * Everything is stored as big-endian 32-bit words, or as a length followed
+ * by bytes padded to a word. Strings include their terminating nul.
+ *
+ *	file:	PRECOMPILED_MAGIC PRECOMPILED_VERSION string:dtc-version
+ *		bytes:search-path count (name hash-high hash-low)... ops
+ *	ops:	(type srcpos op)... OP_END
+ *	op:	node				FRAGMENT_ROOT
+ *		string:label string:ref node	FRAGMENT_REF, "" if no label
+ *		string:ref			FRAGMENT_DELETE
+ *		name ops			FRAGMENT_INCLUDE
+ *	srcpos:	name first-line first-column last-line last-column
+ *	name:	relative string		file name, relative to the
+ *					directory of the include file if set
+ *	node:	deleted string:name labels count prop... count node...
+ *	prop:	deleted string:name labels data
+ *	labels:	count (deleted string)...
+ *	data:	bytes count (type offset string:ref)...
+ */
+
+#define PRECOMPILED_MAGIC	0x44544350	/* "DTCP" */
+#define PRECOMPILED_VERSION	2
+#define OP_END			0xffffffff
+
+/* Darwin has the POSIX.1-2008 nanosecond mtime under another name */
+#ifdef __APPLE__
+#define st_mtim			st_mtimespec
+#endif
+
+/*
+ * The hash of each file read so far, with what stat() said about the file
+ * at the time, so that it is only read again if it seems to have changed
+ */
+struct file_hash {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	uint64_t hash;
+	struct file_hash *next;
+};
+
+static struct file_hash *file_hashes;
+
+/* 64-bit FNV-1a hash of a file's contents */
+static int hash_file(const char *fname, uint64_t *hashp)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	struct file_hash *fh;
+	struct stat st;
+	char *buf;
+	off_t len, i;
+	int ret;
+
+	if (stat(fname, &st))
+		return errno;
+
+	for (fh = file_hashes; fh; fh = fh->next)
+		if ((fh->dev == st.st_dev) && (fh->ino == st.st_ino))
+			break;
+	if (fh && (fh->size == st.st_size)
+	    && (fh->mtime.tv_sec == st.st_mtim.tv_sec)
+	    && (fh->mtime.tv_nsec == st.st_mtim.tv_nsec)) {
+		*hashp = fh->hash;
+		return 0;
+	}
+
+	ret = utilfdt_map_err(fname, &buf, &len);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)buf[i]) * 0x100000001b3ULL;
+	utilfdt_unmap(buf);
+
+	if (!fh) {
+		fh = xmalloc(sizeof(*fh));
+		fh->dev = st.st_dev;
+		fh->ino = st.st_ino;
+		fh->next = file_hashes;
+		file_hashes = fh;
+	}
+	fh->size = st.st_size;
+	fh->mtime = st.st_mtim;
+	fh->hash = hash;
+
+	*hashp = hash;
+	return 0;
+}
+
+struct writer {
+	struct data d;
+	const char *dir;	/* directory of the include file, with '/' */
+	int dirlen;
+};
+
+static void put_u32(struct writer *w, uint32_t val)
+{
+	w->d = data_append_cell(w->d, val);
+}
+
+static void put_bytes(struct writer *w, const char *p, int len)
+{
+	put_u32(w, len);
+	w->d = data_append_data(w->d, p, len);
+	w->d = data_append_align(w->d, sizeof(uint32_t));
+}
+
+static void put_string(struct writer *w, const char *s)
+{
+	put_bytes(w, s, strlen(s) + 1);
+}
+
+static void put_name(struct writer *w, const char *name)
+{
+	bool relative;
+
+	if (w->dirlen)
+		relative = !strncmp(name, w->dir, w->dirlen);
+	else
+		relative = (name[0] != '/');
+
+	put_u32(w, relative);
+	put_string(w, relative ? name + w->dirlen : name);
+}
+
+static void put_srcpos(struct writer *w, struct srcpos *pos)
+{
+	put_name(w, pos->file->name);
+	put_u32(w, pos->first_line);
+	put_u32(w, pos->first_column);
+	put_u32(w, pos->last_line);
+	put_u32(w, pos->last_column);
+}
+
+static void put_labels(struct writer *w, struct label *labels)
+{
+	struct label *l;
+	int n = 0;
+
+	for_each_label_withdel(labels, l)
+		n++;
+	put_u32(w, n);
+	for_each_label_withdel(labels, l) {
+		put_u32(w, l->deleted);
+		put_string(w, l->label);
+	}
+}
+
+static void put_data(struct writer *w, struct data d)
+{
+	struct marker *m;
+	int n = 0;
+
+	put_bytes(w, d.val, d.len);
+	m = d.markers;
+	for_each_marker(m)
+		n++;
+	put_u32(w, n);
+	m = d.markers;
+	for_each_marker(m) {
+		put_u32(w, m->type);
+		put_u32(w, m->offset);
+		put_string(w, m->ref);
+	}
+}
+
+static void put_node(struct writer *w, struct node *node)
+{
+	struct property *prop;
+	struct node *child;
+	int n;
+
+	put_u32(w, node->deleted);
+	put_string(w, node->name ? node->name : "");
+	put_labels(w, node->labels);
+
+	n = 0;
+	for_each_property_withdel(node, prop)
+		n++;
+	put_u32(w, n);
+	for_each_property_withdel(node, prop) {
+		put_u32(w, prop->deleted);
+		put_string(w, prop->name);
+		put_labels(w, prop->labels);
+		put_data(w, prop->val);
+	}
+
+	n = 0;
+	for_each_child_withdel(node, child)
+		n++;
+	put_u32(w, n);
+	for_each_child_withdel(node, child)
+		put_node(w, child);
+}
+
+static void put_ops(struct writer *w, struct fragment_op *op)
+{
+	for (; op; op = op->next) {
+		put_u32(w, op->type);
+		put_srcpos(w, op->srcpos);
+		switch (op->type) {
+		case FRAGMENT_ROOT:
+			put_node(w, op->node);
+			break;
+		case FRAGMENT_REF:
+			put_string(w, op->label ? op->label : "");
+			put_string(w, op->ref);
+			put_node(w, op->node);
+			break;
+		case FRAGMENT_DELETE:
+			put_string(w, op->ref);
+			break;
+		case FRAGMENT_INCLUDE:
+			put_name(w, op->include->name);
+			put_ops(w, op->include->ops);
+			break;
+		}
+	}
+	put_u32(w, OP_END);
+}
+
+int precompile_fragment(struct fragment *f, struct data *image)
+{
+	const char *slash = strrchr(f->name, '/');
+	struct writer w;
+	uint64_t hash;
+	int i, ret;
+
+	w.d = empty_data;
+	w.dir = f->name;
+	w.dirlen = slash ? slash + 1 - f->name : 0;
+
+	put_u32(&w, PRECOMPILED_MAGIC);
+	put_u32(&w, PRECOMPILED_VERSION);
+	put_string(&w, DTC_VERSION);
+	put_bytes(&w, f->search_path.len ? f->search_path.val : "",
+		  f->search_path.len);
+
+	put_u32(&w, f->deps->count);
+	for (i = 0; i < f->deps->count; i++) {
+		ret = hash_file(f->deps->names[i], &hash);
+		if (ret) {
+			data_free(w.d);
+			return ret;
+		}
+		put_name(&w, f->deps->names[i]);
+		put_u32(&w, hash >> 32);
+		put_u32(&w, hash);
+	}
+
+	put_ops(&w, f->ops);
+
+	*image = w.d;
+	return 0;
+}
+
+void write_precompiled(const char *fname, struct fragment *f)
+{
+	struct data image;
+	FILE *out;
+	int ret;
+
+	ret = precompile_fragment(f, &image);
+	if (ret)
+		die("Couldn't read a file %s was made from: %s\n", f->name,
+		    strerror(ret));
+
+	out = fopen(fname, "wb");
+	if (!out)
+		die("Couldn't open output file %s: %s\n", fname,
+		    strerror(errno));
+	if ((fwrite(image.val, 1, image.len, out) != image.len) || fclose(out))
+		die("Error writing %s: %s\n", fname, strerror(errno));
+
+	data_free(image);
+}
+
+/*
+ * Reading stops at the first problem, after which everything read is
+ * zero or empty and bad is set
+ */
+struct reader {
+	char *p, *end;
+	bool bad;
+	const char *dir;	/* directory of the include file, with '/' */
+	union block *blocks;	/* everything allocated, newest first */
+};
+
+/*
+ * Each allocation for a fragment is chained to the others, so that
+ * free_precompiled() can release the lot
+ */
+union block {
+	union block *next;
+	long long align;	/* for what follows the header */
+};
+
+static void *alloc(struct reader *r, size_t len)
+{
+	union block *b = xmalloc(sizeof(*b) + len);
+
+	b->next = r->blocks;
+	r->blocks = b;
+	memset(b + 1, 0, len);
+	return b + 1;
+}
+
+static void free_blocks(union block *b)
+{
+	union block *next;
+
+	for (; b; b = next) {
+		next = b->next;
+		free(b);
+	}
+}
+
+static uint32_t get_u32(struct reader *r)
+{
+	fdt32_t val;
+
+	if (r->bad || (r->end - r->p < sizeof(val))) {
+		r->bad = true;
+		return 0;
+	}
+
+	memcpy(&val, r->p, sizeof(val));
+	r->p += sizeof(val);
+	return fdt32_to_cpu(val);
+}
+
+static char *get_bytes(struct reader *r, int *lenp)
+{
+	uint32_t len = get_u32(r);
+	size_t padded = ((size_t)len + 3) & ~(size_t)3;
+	char *p = r->p;
+
+	if (r->bad || ((int)len < 0) || (padded > r->end - r->p)) {
+		r->bad = true;
+		*lenp = 0;
+		return NULL;
+	}
+
+	r->p += padded;
+	*lenp = len;
+	return p;
+}
+
+static char *get_string(struct reader *r)
+{
+	static char none[] = "";
+	char *s;
+	int len;
+
+	s = get_bytes(r, &len);
+	if (!s || !len || s[len - 1]) {
+		r->bad = true;
+		return none;
+	}
+
+	return s;
+}
+
+static char *get_name(struct reader *r)
+{
+	bool relative = get_u32(r);
+	char *name = get_string(r);
+	char *full;
+
+	full = alloc(r, (relative ? strlen(r->dir) : 0) + strlen(name) + 1);
+	if (relative)
+		strcpy(full, r->dir);
+	strcat(full, name);
+	return full;
+}
+
+static struct srcpos *get_srcpos(struct reader *r)
+{
+	struct srcpos *pos = alloc(r, sizeof(*pos));
+
+	pos->file = alloc(r, sizeof(*pos->file));
+	pos->file->name = get_name(r);
+	pos->first_line = get_u32(r);
+	pos->first_column = get_u32(r);
+	pos->last_line = get_u32(r);
+	pos->last_column = get_u32(r);
+
+	return pos;
+}
+
+static struct label *get_labels(struct reader *r)
+{
+	struct label *labels = NULL, **lp = &labels;
+	uint32_t n = get_u32(r);
+
+	for (; n && !r->bad; n--) {
+		*lp = alloc(r, sizeof(**lp));
+		(*lp)->deleted = get_u32(r);
+		(*lp)->label = get_string(r);
+		lp = &(*lp)->next;
+	}
+
+	return labels;
+}
+
+static struct data get_data(struct reader *r)
+{
+	struct data d = empty_data;
+	struct marker **mp = &d.markers;
+	uint32_t type, offset, prev = 0;
+	uint32_t n;
+
+	d.val = get_bytes(r, &d.len);	/* borrowed from the image */
+
+	for (n = get_u32(r); n && !r->bad; n--) {
+		type = get_u32(r);
+		offset = get_u32(r);
+		/* Markers are in order, and a phandle needs a whole cell */
+		if ((type > LABEL) || (offset < prev) || (offset > d.len)
+		    || ((type == REF_PHANDLE)
+			&& (d.len - offset < sizeof(cell_t)))) {
+			r->bad = true;
+			break;
+		}
+		prev = offset;
+
+		*mp = alloc(r, sizeof(**mp));
+		(*mp)->type = type;
+		(*mp)->offset = offset;
+		(*mp)->ref = get_string(r);
+		mp = &(*mp)->next;
+	}
+
+	return d;
+}
+
+static struct node *get_node(struct reader *r)
+{
+	struct node *node = alloc(r, sizeof(*node));
+	struct node **cp = &node->children;
+	struct property **pp = &node->proplist;
+	uint32_t n;
+
+	node->deleted = get_u32(r);
+	node->name = get_string(r);
+	if (!*node->name)
+		node->name = NULL;
+	node->labels = get_labels(r);
+
+	for (n = get_u32(r); n && !r->bad; n--) {
+		*pp = alloc(r, sizeof(**pp));
+		(*pp)->deleted = get_u32(r);
+		(*pp)->name = get_string(r);
+		(*pp)->labels = get_labels(r);
+		(*pp)->val = get_data(r);
+		pp = &(*pp)->next;
+	}
+
+	for (n = get_u32(r); n && !r->bad; n--) {
+		*cp = get_node(r);
+		(*cp)->parent = node;
+		cp = &(*cp)->next_sibling;
+	}
+
+	return node;
+}
+
+static struct fragment_op *get_ops(struct reader *r)
+{
+	struct fragment_op *ops = NULL, **opp = &ops;
+	uint32_t type;
+
+	while (((type = get_u32(r)) != OP_END) && !r->bad) {
+		*opp = alloc(r, sizeof(**opp));
+		(*opp)->type = type;
+		(*opp)->srcpos = get_srcpos(r);
+		switch (type) {
+		case FRAGMENT_ROOT:
+			(*opp)->node = get_node(r);
+			break;
+		case FRAGMENT_REF:
+			(*opp)->label = get_string(r);
+			if (!*(*opp)->label)
+				(*opp)->label = NULL;
+			(*opp)->ref = get_string(r);
+			(*opp)->node = get_node(r);
+			break;
+		case FRAGMENT_DELETE:
+			(*opp)->ref = get_string(r);
+			break;
+		case FRAGMENT_INCLUDE:
+			(*opp)->include = alloc(r, sizeof(*(*opp)->include));
+			(*opp)->include->name = get_name(r);
+			(*opp)->include->deps = alloc(r, sizeof(struct dep_list));
+			(*opp)->include->ops = get_ops(r);
+			break;
+		default:
+			r->bad = true;
+		}
+		opp = &(*opp)->next;
+	}
+
+	return ops;
+}
+
+struct fragment *read_precompiled(const char *name, char *buf, off_t len)
+{
+	const char *slash = strrchr(name, '/');
+	struct fragment *f = NULL;
+	struct dep_list *deps;
+	struct reader r;
+	uint64_t hash, now;
+	uint32_t n;
+	char *dir, *path;
+	int path_len;
+
+	dir = xstrdup(name);
+	dir[slash ? slash + 1 - name : 0] = '\0';
+	r.p = buf;
+	r.end = buf + len;
+	r.bad = false;
+	r.dir = dir;
+	r.blocks = NULL;
+
+	if ((get_u32(&r) != PRECOMPILED_MAGIC)
+	    || (get_u32(&r) != PRECOMPILED_VERSION)
+	    || !streq(get_string(&r), DTC_VERSION))
+		goto out;
+	path = get_bytes(&r, &path_len);
+
+	f = alloc(&r, sizeof(*f));
+	f->name = xstrdup(name);
+	f->search_path.val = path;
+	f->search_path.len = path_len;
+	f->deps = deps = alloc(&r, sizeof(*f->deps));
+	for (n = get_u32(&r); n && !r.bad; n--) {
+		char *dep = get_name(&r);
+
+		hash = (uint64_t)get_u32(&r) << 32;
+		hash |= get_u32(&r);
+		if (r.bad || hash_file(dep, &now) || (now != hash)) {
+			r.bad = true;
+			break;
+		}
+
+		deps->names = xrealloc(deps->names, (deps->count + 1)
+				       * sizeof(*deps->names));
+		deps->hashes = xrealloc(deps->hashes, (deps->count + 1)
+					* sizeof(*deps->hashes));
+		deps->names[deps->count] = dep;
+		deps->hashes[deps->count++] = hash;
+	}
+
+	f->ops = get_ops(&r);
+
+out:
+	free(dir);
+	if (!f || r.bad || (r.p != r.end)) {
+		if (f) {
+			free(f->name);
+			free(f->deps->names);
+			free(f->deps->hashes);
+		}
+		free_blocks(r.blocks);
+		return NULL;
+	}
+
+	f->image = buf;
+	f->mem = r.blocks;
+	return f;
+}
+
+/* Free a fragment from read_precompiled(), though not the image it used */
+void free_precompiled(struct fragment *f)
+{
+	free(f->name);
+	free(f->deps->names);
+	free(f->deps->hashes);
+	free_blocks(f->mem);
+}
+
+struct fragment *load_precompiled(const char *name)
+{
+	struct fragment *f;
+	char *fname, *buf;
+	off_t len;
+
+	fname = xmalloc(strlen(name) + strlen(PRECOMPILED_SUFFIX) + 1);
+	strcpy(fname, name);
+	strcat(fname, PRECOMPILED_SUFFIX);
+	if (utilfdt_map_err(fname, &buf, &len)) {
+		free(fname);
+		return NULL;
+	}
+	free(fname);
+
+	f = read_precompiled(name, buf, len);
+	if (f && fragment_path_changed(f)) {
+		free_precompiled(f);
+		f = NULL;
+	}
+	if (!f)
+		utilfdt_unmap(buf);
+
+	return f;
+}
+
+bool fragment_changed(struct fragment *f)
+{
+	uint64_t hash;
+	int i;
+
+	if (!f->deps->hashes)
+		return false;
+
+	for (i = 0; i < f->deps->count; i++)
+		if (hash_file(f->deps->names[i], &hash)
+		    || (hash != f->deps->hashes[i]))
+			return true;
+
+	return false;
+}
+
+/*
+ * Whether the files a fragment includes may not be those the same
+ * includes would find now, since the search path has changed
+ */
+bool fragment_path_changed(struct fragment *f)
+{
+	struct data path = srcfile_search_path();
+
+	/* Only its includes are looked for on the search path */
+	if (f->deps->count < 2)
+		return false;
+
+	return (f->search_path.len != path.len)
+		|| (path.len && memcmp(f->search_path.val, path.val, path.len));
+}
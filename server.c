@@ -0,0 +1,649 @@
+/*
+ * Compile server
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *                                                                   USA
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "dtc.h"
+#include "srcpos.h"
+
+/*
+ * dtc --server listens on a UNIX socket for requests to run dtc. A run of
+ * dtc with DTC_SERVER set to the name of the socket sends its command line,
+ * working directory and standard input, output and error to the server,
+ * then exits with the status the server sends back, without compiling
+ * anything itself.
+ *
+ * Each request is run in a child process forked from the server, so that
+ * it behaves just as a run of dtc by itself would, down to how it fails.
+ * The child starts with every fragment (see parse_fragment()) the server
+ * has for its working directory, so it only parses the files it includes
+ * which are new or have changed, or which include others and were parsed
+ * with another search path. Before it exits, it sends the server any
+ * fragments it parsed, precompiled (see precompile.c), for later requests.
+ * Before each request, the server drops the fragments made from any file
+ * which has changed since. A file is only read again to check that if
+ * stat() says that it may have changed.
+ *
+ *	request:	length string:dir string:arg...
+ *			with the client's descriptors 0-2 attached
+ *	reply:		exit-status
+ *	from child:	(length string:name length image)...
+ *
+ * Lengths and the exit status are 32-bit values in the machine's byte
+ * order. Strings include their terminating nul.
+ */
+
+#define MAX_REQUEST	(1 << 20)
+
+/* The fragments for each working directory, since their names depend on it */
+struct dir_cache {
+	char *dir;
+	struct fragment *fragments;
+	struct dir_cache *next;
+};
+
+/* A request being run */
+struct job {
+	pid_t pid;
+	int client;		/* to send the exit status to */
+	int pipe;		/* fragments from the child */
+	struct data images;
+	struct dir_cache *cache;
+	struct job *next;
+};
+
+/* A request still arriving, read as the client sends it */
+struct request {
+	int client;
+	int fds[3];		/* client's descriptors 0-2, or -1 */
+	uint32_t len;		/* of the strings */
+	uint32_t got;		/* how much of them has arrived */
+	char *buf;		/* the strings, once their length is known */
+	struct request *next;
+};
+
+static struct dir_cache *dir_caches;
+static struct job *running;
+static int num_running;
+static struct request *requests;
+static int num_requests;
+
+/* In a child, where to send fragments and which the server already has */
+static int images_fd = -1;
+static struct fragment *server_fragments;
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = read(fd, p, len);
+		if ((ret < 0) && (errno == EINTR))
+			continue;
+		if (ret <= 0)
+			return false;
+		p += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if ((ret < 0) && (errno == EINTR))
+			continue;
+		if (ret <= 0)
+			return false;
+		p += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+static bool send_bytes(int fd, const void *p, uint32_t len)
+{
+	return write_all(fd, &len, sizeof(len)) && write_all(fd, p, len);
+}
+
+/* Run in the child as it exits, however that comes about */
+static void send_fragments(void)
+{
+	struct fragment *f;
+	struct data d;
+	bool ok;
+
+	for (f = fragment_cache; f != server_fragments; f = f->next) {
+		if (f->failed || precompile_fragment(f, &d))
+			continue;
+		ok = send_bytes(images_fd, f->name, strlen(f->name) + 1)
+			&& send_bytes(images_fd, d.val, d.len);
+		data_free(d);
+		if (!ok)
+			break;
+	}
+	close(images_fd);
+}
+
+static struct dir_cache *get_dir_cache(const char *dir)
+{
+	struct dir_cache *cache;
+
+	for (cache = dir_caches; cache; cache = cache->next)
+		if (streq(cache->dir, dir))
+			return cache;
+
+	cache = xmalloc(sizeof(*cache));
+	cache->dir = xstrdup(dir);
+	cache->fragments = NULL;
+	cache->next = dir_caches;
+	dir_caches = cache;
+
+	return cache;
+}
+
+/* Drop and free fragments made from files which have changed */
+static void expire_fragments(struct dir_cache *cache)
+{
+	struct fragment **fp = &cache->fragments;
+	struct fragment *f;
+	char *image;
+
+	while (*fp) {
+		f = *fp;
+		if (fragment_changed(f)) {
+			*fp = f->next;
+			image = f->image;
+			free_precompiled(f);
+			free(image);
+		} else {
+			fp = &f->next;
+		}
+	}
+}
+
+/* Whether the cache has a fragment which will do wherever f would */
+static bool have_fragment(struct dir_cache *cache, struct fragment *f)
+{
+	struct fragment *g;
+
+	for (g = cache->fragments; g; g = g->next)
+		if (streq(g->name, f->name)
+		    && ((f->deps->count < 2)
+			|| ((g->search_path.len == f->search_path.len)
+			    && !memcmp(g->search_path.val, f->search_path.val,
+				       f->search_path.len))))
+			return true;
+
+	return false;
+}
+
+/* Add the fragments a child sent to its directory's cache */
+static void add_fragments(struct dir_cache *cache, struct data images)
+{
+	char *p = images.val, *end = images.val + images.len;
+	struct fragment *f;
+	uint32_t len;
+	char *name, *buf;
+
+	while (end - p >= sizeof(len)) {
+		memcpy(&len, p, sizeof(len));
+		p += sizeof(len);
+		if ((len > end - p) || !len || p[len - 1])
+			break;
+		name = p;
+		p += len;
+
+		if (end - p < sizeof(len))
+			break;
+		memcpy(&len, p, sizeof(len));
+		p += sizeof(len);
+		if (len > end - p)
+			break;
+
+		/* The fragment's strings and values point into it */
+		buf = xmalloc(len);
+		memcpy(buf, p, len);
+		f = read_precompiled(name, buf, len);
+		if (f && !have_fragment(cache, f)) {
+			f->next = cache->fragments;
+			cache->fragments = f;
+		} else {
+			if (f)
+				free_precompiled(f);
+			free(buf);
+		}
+		p += len;
+	}
+}
+
+/* Only the server's own user may have it run things */
+static bool client_is_user(int client)
+{
+#ifdef __linux__
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	return !getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len)
+		&& (cred.uid == getuid());
+#else
+	uid_t uid;
+	gid_t gid;
+
+	return !getpeereid(client, &uid, &gid) && (uid == getuid());
+#endif
+}
+
+/* Accept a connection, to read its request as it arrives */
+static void accept_request(int sock)
+{
+	struct request *req;
+	int client;
+
+	client = accept(sock, NULL, NULL);
+	if (client < 0)
+		return;
+
+	if (!client_is_user(client)
+	    || (fcntl(client, F_SETFL, O_NONBLOCK) < 0)) {
+		close(client);
+		return;
+	}
+
+	req = xmalloc(sizeof(*req));
+	memset(req, 0, sizeof(*req));
+	req->client = client;
+	req->fds[0] = req->fds[1] = req->fds[2] = -1;
+	req->next = requests;
+	requests = req;
+	num_requests++;
+}
+
+static void unlink_request(struct request *req)
+{
+	struct request **rp;
+
+	for (rp = &requests; *rp != req; rp = &(*rp)->next)
+		;
+	*rp = req->next;
+	num_requests--;
+}
+
+static void free_request(struct request *req)
+{
+	int i;
+
+	close(req->client);
+	for (i = 0; i < 3; i++)
+		if (req->fds[i] >= 0)
+			close(req->fds[i]);
+	free(req->buf);
+	free(req);
+}
+
+/*
+ * Read what has arrived of a request without waiting for more, returning
+ * 1 if it is complete, 0 if there is more to come or -1 if there is a
+ * problem
+ */
+static int read_request(struct request *req)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t ret;
+	int i, n, fd, nfds = 0;
+
+	if (!req->buf) {
+		iov.iov_base = &req->len;
+		iov.iov_len = sizeof(req->len);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		ret = recvmsg(req->client, &msg, 0);
+		if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+			return 0;
+
+		/* Take whatever descriptors came, so that they are closed */
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if ((cmsg->cmsg_level != SOL_SOCKET)
+			    || (cmsg->cmsg_type != SCM_RIGHTS))
+				continue;
+			n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (i = 0; i < n; i++, nfds++) {
+				memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+				       sizeof(int));
+				if (nfds < 3)
+					req->fds[nfds] = fd;
+				else
+					close(fd);
+			}
+		}
+
+		if ((ret != sizeof(req->len)) || (nfds != 3)
+		    || (msg.msg_flags & MSG_CTRUNC)
+		    || !req->len || (req->len > MAX_REQUEST))
+			return -1;
+		req->buf = xmalloc(req->len + 1);
+		req->buf[req->len] = '\0';
+	}
+
+	while (req->got < req->len) {
+		ret = read(req->client, req->buf + req->got,
+			   req->len - req->got);
+		if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+			return 0;
+		if (ret <= 0)
+			return -1;
+		req->got += ret;
+	}
+
+	return req->buf[req->len - 1] ? -1 : 1;
+}
+
+/* Run a request in the child, leaving only what it needs open */
+static void __attribute__((noreturn)) run_job(int sock, int client,
+					      int fds[3], int images,
+					      struct dir_cache *cache,
+					      char *argv[],
+					      void (*run)(int, char **))
+{
+	struct request *req, *next;
+	struct job *job;
+	int i, argc;
+
+	close(sock);
+	close(client);
+	for (job = running; job; job = job->next) {
+		close(job->client);
+		close(job->pipe);
+	}
+	for (req = requests; req; req = next) {
+		next = req->next;
+		free_request(req);
+	}
+	for (i = 0; i < 3; i++) {
+		dup2(fds[i], i);
+		close(fds[i]);
+	}
+	signal(SIGPIPE, SIG_DFL);
+	unsetenv("DTC_SERVER");
+
+	fragment_cache = server_fragments = cache->fragments;
+	images_fd = images;
+	atexit(send_fragments);
+
+	for (argc = 0; argv[argc]; argc++)
+		;
+	optind = 0;
+	run(argc, argv);
+	exit(0);
+}
+
+/* Start a job for a request which has arrived, taking it over */
+static void start_job(int sock, struct request *req,
+		      void (*run)(int, char **))
+{
+	struct dir_cache *cache = NULL;
+	struct job *job;
+	char *buf = req->buf, *p, **argv;
+	int client = req->client, *fds = req->fds, pipefd[2], argc, i;
+	uint32_t len = req->len;
+	pid_t pid;
+
+	/* Only the exit status is left to send, which may as well block */
+	fcntl(client, F_SETFL, 0);
+
+	/* The strings are the directory, then the arguments */
+	argc = -1;
+	for (p = buf; p < buf + len; p += strlen(p) + 1)
+		argc++;
+	argv = xmalloc((argc + 1) * sizeof(*argv));
+	p = buf + strlen(buf) + 1;
+	for (i = 0; i < argc; i++, p += strlen(p) + 1)
+		argv[i] = p;
+	argv[argc] = NULL;
+
+	pid = -1;
+	if (!argc) {
+		errno = EINVAL;
+	} else if (!chdir(buf) && !pipe(pipefd)) {
+		cache = get_dir_cache(buf);
+		expire_fragments(cache);
+		fflush(NULL);
+		pid = fork();
+		if (!pid)
+			run_job(sock, client, fds, pipefd[1], cache, argv, run);
+		close(pipefd[1]);
+		if (pid < 0)
+			close(pipefd[0]);
+	}
+
+	if (pid < 0) {
+		dprintf(fds[2], "FATAL ERROR: dtc server couldn't run request "
+			"in %s: %s\n", buf, strerror(errno));
+		len = 1;
+		write_all(client, &len, sizeof(len));
+		close(client);
+	} else {
+		job = xmalloc(sizeof(*job));
+		job->pid = pid;
+		job->client = client;
+		job->pipe = pipefd[0];
+		job->images = empty_data;
+		job->cache = cache;
+		job->next = running;
+		running = job;
+		num_running++;
+	}
+
+	for (i = 0; i < 3; i++)
+		close(fds[i]);
+	free(argv);
+	free(buf);
+	free(req);
+}
+
+/* Called when the child has closed its end of the pipe */
+static void finish_job(struct job *job)
+{
+	struct job **jp;
+	uint32_t ret;
+	int status;
+
+	while ((waitpid(job->pid, &status, 0) < 0) && (errno == EINTR))
+		;
+	if (WIFEXITED(status))
+		ret = WEXITSTATUS(status);
+	else
+		ret = 128 + WTERMSIG(status);
+
+	if (!chdir(job->cache->dir))
+		add_fragments(job->cache, job->images);
+	write_all(job->client, &ret, sizeof(ret));
+
+	close(job->client);
+	close(job->pipe);
+	data_free(job->images);
+	for (jp = &running; *jp != job; jp = &(*jp)->next)
+		;
+	*jp = job->next;
+	num_running--;
+	free(job);
+}
+
+void serve(const char *sockname, void (*run)(int argc, char *argv[]))
+{
+	struct sockaddr_un addr;
+	struct pollfd *pfds = NULL;
+	struct job *job, *next;
+	struct request *req, *next_req;
+	char buf[4096];
+	ssize_t len;
+	int sock, ret, i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(sockname) >= sizeof(addr.sun_path))
+		die("Socket name %s is too long\n", sockname);
+	strcpy(addr.sun_path, sockname);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		die("Couldn't create socket: %s\n", strerror(errno));
+	unlink(sockname);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))
+	    || listen(sock, SOMAXCONN))
+		die("Couldn't listen on %s: %s\n", sockname, strerror(errno));
+
+	/* Clients going away must not stop the server */
+	signal(SIGPIPE, SIG_IGN);
+	cache_includes = true;
+
+	for (;;) {
+		/* Requests still arriving are waited for with the jobs */
+		pfds = xrealloc(pfds, (num_running + num_requests + 1)
+				* sizeof(*pfds));
+		pfds[0].fd = sock;
+		pfds[0].events = POLLIN;
+		for (job = running, i = 1; job; job = job->next, i++) {
+			pfds[i].fd = job->pipe;
+			pfds[i].events = POLLIN;
+		}
+		for (req = requests; req; req = req->next, i++) {
+			pfds[i].fd = req->client;
+			pfds[i].events = POLLIN;
+		}
+
+		if (poll(pfds, i, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("poll() failed: %s\n", strerror(errno));
+		}
+
+		/* Jobs and requests are in the same order as in pfds */
+		for (job = running, i = 1; job; job = next, i++) {
+			next = job->next;
+			if (!pfds[i].revents)
+				continue;
+			len = read(job->pipe, buf, sizeof(buf));
+			if (len > 0)
+				job->images = data_append_data(job->images,
+							       buf, len);
+			else if ((len == 0) || (errno != EINTR))
+				finish_job(job);
+		}
+
+		for (req = requests; req; req = next_req, i++) {
+			next_req = req->next;
+			if (!pfds[i].revents)
+				continue;
+			ret = read_request(req);
+			if (ret) {
+				unlink_request(req);
+				if (ret > 0)
+					start_job(sock, req, run);
+				else
+					free_request(req);
+			}
+		}
+
+		if (pfds[0].revents)
+			accept_request(sock);
+	}
+}
+
+void run_on_server(const char *sockname, int argc, char *argv[])
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	struct data d = empty_data;
+	int fds[3] = { 0, 1, 2 };
+	int sock, i;
+	uint32_t len, status;
+	char *dir;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(sockname) >= sizeof(addr.sun_path))
+		die("Socket name %s is too long\n", sockname);
+	strcpy(addr.sun_path, sockname);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((sock < 0)
+	    || connect(sock, (struct sockaddr *)&addr, sizeof(addr)))
+		die("Couldn't connect to dtc server %s: %s\n", sockname,
+		    strerror(errno));
+
+	dir = getcwd(NULL, 0);
+	if (!dir)
+		die("Couldn't get working directory: %s\n", strerror(errno));
+	d = data_append_data(d, dir, strlen(dir) + 1);
+	for (i = 0; i < argc; i++)
+		d = data_append_data(d, argv[i], strlen(argv[i]) + 1);
+	free(dir);
+
+	len = d.len;
+	iov.iov_base = &len;
+	iov.iov_len = sizeof(len);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if ((sendmsg(sock, &msg, 0) != sizeof(len))
+	    || !write_all(sock, d.val, d.len)
+	    || !read_all(sock, &status, sizeof(status)))
+		die("Lost connection to dtc server %s\n", sockname);
+
+	exit(status);
+}
@@ -33,6 +33,10 @@ struct search_path {
 /* This is the list of directories that we search for source files */
 static struct search_path *search_path_head, **search_path_tail;
 
+/* The same list, as srcfile_search_path() returns it */
+static char *search_path_str;
+static int search_path_len;
+
 
 static char *get_dirname(const char *path)
 {
@@ -50,11 +54,12 @@ static char *get_dirname(const char *path)
 }
 
 FILE *depfile; /* = NULL */
-struct srcfile_state *current_srcfile; /* = NULL */
+struct dep_list *dep_list; /* = NULL */
+bool srcpos_quiet; /* = false */
+int srcpos_quiet_count; /* = 0 */
 
 /* Detect infinite include recursion. */
 #define MAX_SRCFILE_DEPTH     (100)
-static int srcfile_depth; /* = 0 */
 
 
 /**
@@ -91,11 +96,13 @@ static char *try_open(const char *dirname, const char *fname, FILE **fp)
  *
  * If it is a relative filename, we search the full search path for it.
  *
+ * @param from	File being read which refers to it, or NULL if none
  * @param fname	Filename to open
  * @param fp	Returns pointer to opened FILE, or NULL on failure
  * @return pointer to allocated filename, which caller must free
  */
-static char *fopen_any_on_path(const char *fname, FILE **fp)
+static char *fopen_any_on_path(struct srcfile_state *from, const char *fname,
+			       FILE **fp)
 {
 	const char *cur_dir = NULL;
 	struct search_path *node;
@@ -103,8 +110,8 @@ static char *fopen_any_on_path(const char *fname, FILE **fp)
 
 	/* Try current directory first */
 	assert(fp);
-	if (current_srcfile)
-		cur_dir = current_srcfile->dir;
+	if (from)
+		cur_dir = from->dir;
 	fullname = try_open(cur_dir, fname, fp);
 
 	/* Failing that, try each search path in turn */
@@ -114,7 +121,8 @@ static char *fopen_any_on_path(const char *fname, FILE **fp)
 	return fullname;
 }
 
-FILE *srcfile_relative_open(const char *fname, char **fullnamep)
+FILE *srcfile_relative_open(struct srcfile_state *from, const char *fname,
+			    char **fullnamep)
 {
 	FILE *f;
 	char *fullname;
@@ -123,14 +131,13 @@ FILE *srcfile_relative_open(const char *fname, char **fullnamep)
 		f = stdin;
 		fullname = xstrdup("<stdin>");
 	} else {
-		fullname = fopen_any_on_path(fname, &f);
+		fullname = fopen_any_on_path(from, fname, &f);
 		if (!f)
 			die("Couldn't open \"%s\": %s\n", fname,
 			    strerror(errno));
 	}
 
-	if (depfile)
-		fprintf(depfile, " %s", fullname);
+	srcfile_add_dependency(fullname);
 
 	if (fullnamep)
 		*fullnamep = fullname;
@@ -140,32 +147,46 @@ FILE *srcfile_relative_open(const char *fname, char **fullnamep)
 	return f;
 }
 
-void srcfile_push(const char *fname)
+void srcfile_add_dependency(const char *fullname)
+{
+	if (depfile)
+		fprintf(depfile, " %s", fullname);
+
+	if (dep_list) {
+		dep_list->names = xrealloc(dep_list->names, (dep_list->count + 1)
+					   * sizeof(*dep_list->names));
+		dep_list->names[dep_list->count++] = xstrdup(fullname);
+	}
+}
+
+void srcfile_push(struct srcfile_state **stack, const char *fname)
 {
 	struct srcfile_state *srcfile;
+	int depth = *stack ? (*stack)->depth : 0;
 
-	if (srcfile_depth++ >= MAX_SRCFILE_DEPTH)
+	if (depth >= MAX_SRCFILE_DEPTH)
 		die("Includes nested too deeply");
 
 	srcfile = xmalloc(sizeof(*srcfile));
 
-	srcfile->f = srcfile_relative_open(fname, &srcfile->name);
+	srcfile->f = srcfile_relative_open(*stack, fname, &srcfile->name);
 	srcfile->dir = get_dirname(srcfile->name);
-	srcfile->prev = current_srcfile;
+	srcfile->depth = depth + 1;
+	srcfile->prev = *stack;
 
 	srcfile->lineno = 1;
 	srcfile->colno = 1;
 
-	current_srcfile = srcfile;
+	*stack = srcfile;
 }
 
-bool srcfile_pop(void)
+bool srcfile_pop(struct srcfile_state **stack)
 {
-	struct srcfile_state *srcfile = current_srcfile;
+	struct srcfile_state *srcfile = *stack;
 
 	assert(srcfile);
 
-	current_srcfile = srcfile->prev;
+	*stack = srcfile->prev;
 
 	if (fclose(srcfile->f))
 		die("Error closing \"%s\": %s\n", srcfile->name,
@@ -177,7 +198,7 @@ bool srcfile_pop(void)
 	 * fix this we could either allocate all the files from a
 	 * table, or use a pool allocator. */
 
-	return current_srcfile ? true : false;
+	return *stack ? true : false;
 }
 
 void srcfile_add_search_path(const char *dirname)
@@ -195,6 +216,20 @@ void srcfile_add_search_path(const char *dirname)
 	else
 		search_path_head = node;
 	search_path_tail = &node->next;
+
+	search_path_str = xrealloc(search_path_str,
+				   search_path_len + strlen(dirname) + 1);
+	strcpy(search_path_str + search_path_len, dirname);
+	search_path_len += strlen(dirname) + 1;
+}
+
+struct data srcfile_search_path(void)
+{
+	struct data d = empty_data;
+
+	d.val = search_path_str;
+	d.len = search_path_len;
+	return d;
 }
 
 /*
@@ -211,28 +246,28 @@ struct srcpos srcpos_empty = {
 
 #define TAB_SIZE      8
 
-void srcpos_update(struct srcpos *pos, const char *text, int len)
+void srcpos_update(struct srcfile_state *srcfile, struct srcpos *pos,
+		   const char *text, int len)
 {
 	int i;
 
-	pos->file = current_srcfile;
+	pos->file = srcfile;
 
-	pos->first_line = current_srcfile->lineno;
-	pos->first_column = current_srcfile->colno;
+	pos->first_line = srcfile->lineno;
+	pos->first_column = srcfile->colno;
 
 	for (i = 0; i < len; i++)
 		if (text[i] == '\n') {
-			current_srcfile->lineno++;
-			current_srcfile->colno = 1;
+			srcfile->lineno++;
+			srcfile->colno = 1;
 		} else if (text[i] == '\t') {
-			current_srcfile->colno =
-				ALIGN(current_srcfile->colno, TAB_SIZE);
+			srcfile->colno = ALIGN(srcfile->colno, TAB_SIZE);
 		} else {
-			current_srcfile->colno++;
+			srcfile->colno++;
 		}
 
-	pos->last_line = current_srcfile->lineno;
-	pos->last_column = current_srcfile->colno;
+	pos->last_line = srcfile->lineno;
+	pos->last_column = srcfile->colno;
 }
 
 struct srcpos *
@@ -295,6 +330,11 @@ void srcpos_verror(struct srcpos *pos, const char *prefix,
 {
 	char *srcstr;
 
+	if (srcpos_quiet) {
+		srcpos_quiet_count++;
+		return;
+	}
+
 	srcstr = srcpos_string(pos);
 
 	fprintf(stderr, "%s: %s ", prefix, srcstr);
@@ -314,8 +354,8 @@ void srcpos_error(struct srcpos *pos, const char *prefix,
 	va_end(va);
 }
 
-void srcpos_set_line(char *f, int l)
+void srcpos_set_line(struct srcfile_state *srcfile, char *f, int l)
 {
-	current_srcfile->name = f;
-	current_srcfile->lineno = l;
+	srcfile->name = f;
+	srcfile->lineno = l;
 }
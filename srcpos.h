@@ -28,18 +28,38 @@ struct srcfile_state {
 	char *name;
 	char *dir;
 	int lineno, colno;
+	int depth;			/* number of files including this one */
 	struct srcfile_state *prev;
 };
 
 extern FILE *depfile; /* = NULL */
-extern struct srcfile_state *current_srcfile; /* = NULL */
+
+/* The full names of the files something was read from */
+struct dep_list {
+	char **names;
+	uint64_t *hashes;	/* of each file's contents, if known */
+	int count;
+};
+
+/*
+ * If set, the full name of each file opened is added to dep_list, as well
+ * as being written to depfile
+ */
+extern struct dep_list *dep_list; /* = NULL */
+
+/**
+ * Record that a file is needed, in depfile and dep_list
+ *
+ * @param fullname	Full name of the file, as opened
+ */
+void srcfile_add_dependency(const char *fullname);
 
 /**
  * Open a source file.
  *
  * If the source file is a relative pathname, then it is searched for in the
- * current directory (the directory of the last source file read) and after
- * that in the search path.
+ * directory of the source file it is read from and after that in the search
+ * path.
  *
  * We work through the search path in order from the first path specified to
  * the last.
@@ -47,16 +67,33 @@ extern struct srcfile_state *current_srcfile; /* = NULL */
  * If the file is not found, then this function does not return, but calls
  * die().
  *
+ * @param from		File being read which refers to it, or NULL if none
  * @param fname		Filename to search
  * @param fullnamep	If non-NULL, it is set to the allocated filename of the
  *			file that was opened. The caller is then responsible
  *			for freeing the pointer.
  * @return pointer to opened FILE
  */
-FILE *srcfile_relative_open(const char *fname, char **fullnamep);
+FILE *srcfile_relative_open(struct srcfile_state *from, const char *fname,
+			    char **fullnamep);
 
-void srcfile_push(const char *fname);
-bool srcfile_pop(void);
+/**
+ * Open a source file and start reading it, inside the current one
+ *
+ * @param stack		Innermost file being read, or NULL if none. This is
+ *			updated to the new file
+ * @param fname		Filename to open, as for srcfile_relative_open()
+ */
+void srcfile_push(struct srcfile_state **stack, const char *fname);
+
+/**
+ * Finish reading the innermost source file
+ *
+ * @param stack		Innermost file being read, updated to the one which
+ *			included it
+ * @return true if there is still a file being read
+ */
+bool srcfile_pop(struct srcfile_state **stack);
 
 /**
  * Add a new directory to the search path for input files
@@ -67,6 +104,14 @@ bool srcfile_pop(void);
  */
 void srcfile_add_search_path(const char *dirname);
 
+/**
+ * Get the search path for input files
+ *
+ * @return each directory in it, followed by a nul, in order. This must not
+ * be changed or freed.
+ */
+struct data srcfile_search_path(void);
+
 struct srcpos {
     int first_line;
     int first_column;
@@ -102,11 +147,19 @@ struct srcpos {
  */
 extern struct srcpos srcpos_empty;
 
-extern void srcpos_update(struct srcpos *pos, const char *text, int len);
+extern void srcpos_update(struct srcfile_state *srcfile, struct srcpos *pos,
+			  const char *text, int len);
 extern struct srcpos *srcpos_copy(struct srcpos *pos);
 extern char *srcpos_string(struct srcpos *pos);
 extern void srcpos_dump(struct srcpos *pos);
 
+/*
+ * If srcpos_quiet is set, messages are counted in srcpos_quiet_count rather
+ * than being printed
+ */
+extern bool srcpos_quiet;
+extern int srcpos_quiet_count;
+
 extern void srcpos_verror(struct srcpos *pos, const char *prefix,
 			  const char *fmt, va_list va)
 	__attribute__((format(printf, 3, 0)));
@@ -114,6 +167,6 @@ extern void srcpos_error(struct srcpos *pos, const char *prefix,
 			 const char *fmt, ...)
 	__attribute__((format(printf, 3, 4)));
 
-extern void srcpos_set_line(char *f, int l);
+extern void srcpos_set_line(struct srcfile_state *srcfile, char *f, int l);
 
 #endif /* _SRCPOS_H_ */
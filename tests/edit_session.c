@@ -0,0 +1,228 @@
+/*
+ * libfdt - Flat Device Tree manipulation
+ *	Testcase for the batched edit functions (fdt_edit_...())
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libfdt.h>
+
+#include "tests.h"
+#include "testdata.h"
+
+#define SPACE		65536
+#define MAX_OPS		64
+
+struct edit {
+	int type;
+	const char *path;
+	const char *name;
+	const char *val;
+};
+
+/* Each change is made in order, with the path looked up beforehand */
+static const struct edit edits[] = {
+	/* Change existing properties, growing and shrinking them */
+	{ FDT_EDIT_SETPROP, "/", "prop-str", "a much longer string than before" },
+	{ FDT_EDIT_SETPROP, "/", "compatible", "x" },
+	{ FDT_EDIT_SETPROP, "/subnode@1", "prop-int", "" },
+
+	/* Add new properties, some with existing or overlapping names */
+	{ FDT_EDIT_SETPROP, "/", "new-prop", "one" },
+	{ FDT_EDIT_SETPROP, "/", "int", "two" },
+	{ FDT_EDIT_SETPROP, "/", "prop", "three" },
+	{ FDT_EDIT_SETPROP, "/", "new-prop", "one, changed" },
+	{ FDT_EDIT_SETPROP, "/subnode@1/ss1", "another-prop", "four" },
+	{ FDT_EDIT_SETPROP, "/subnode@1/ss1", "prop", "five" },
+
+	/* Delete properties, original and new, then bring some back */
+	{ FDT_EDIT_DELPROP, "/", "prop-int64", NULL },
+	{ FDT_EDIT_DELPROP, "/", "int", NULL },
+	{ FDT_EDIT_SETPROP, "/subnode@1", "reg", "six" },
+	{ FDT_EDIT_DELPROP, "/subnode@1", "reg", NULL },
+	{ FDT_EDIT_SETPROP, "/subnode@1", "reg", "seven" },
+	{ FDT_EDIT_SETPROP, "/", "int", "eight" },
+
+	/* Add nodes, including one to a node with no properties */
+	{ FDT_EDIT_ADD_SUBNODE, "/", "new1", NULL },
+	{ FDT_EDIT_ADD_SUBNODE, "/", "new2", NULL },
+	{ FDT_EDIT_ADD_SUBNODE, "/subnode@2/ss2", "new3@1", NULL },
+	{ FDT_EDIT_SETPROP, "/subnode@2/ss2", "new-prop", "nine" },
+
+	/* Change a node and then delete its parent */
+	{ FDT_EDIT_SETPROP, "/subnode@1/subsubnode", "lost-prop", "ten" },
+	{ FDT_EDIT_ADD_SUBNODE, "/subnode@1/subsubnode", "lost-node", NULL },
+	{ FDT_EDIT_DEL_NODE, "/subnode@1", NULL, NULL },
+
+	/* Replace a node */
+	{ FDT_EDIT_DEL_NODE, "/subnode@2/subsubnode@0", NULL, NULL },
+	{ FDT_EDIT_ADD_SUBNODE, "/subnode@2", "subsubnode", NULL },
+	{ FDT_EDIT_DELPROP, "/subnode@2", "prop-int", NULL },
+};
+
+#define CHECK(code) \
+	{ \
+		err = (code); \
+		if (err) \
+			FAIL(#code ": %s", fdt_strerror(err)); \
+	}
+
+/* Make a change immediately */
+static void do_edit(void *fdt, const struct edit *edit)
+{
+	int offset, err;
+
+	offset = fdt_path_offset(fdt, edit->path);
+	if (offset < 0)
+		FAIL("Couldn't find %s: %s", edit->path, fdt_strerror(offset));
+	switch (edit->type) {
+	case FDT_EDIT_SETPROP:
+		CHECK(fdt_setprop_string(fdt, offset, edit->name, edit->val));
+		break;
+	case FDT_EDIT_DELPROP:
+		CHECK(fdt_delprop(fdt, offset, edit->name));
+		break;
+	case FDT_EDIT_ADD_SUBNODE:
+		err = fdt_add_subnode(fdt, offset, edit->name);
+		if (err < 0)
+			FAIL("fdt_add_subnode(%s): %s", edit->name,
+			     fdt_strerror(err));
+		break;
+	case FDT_EDIT_DEL_NODE:
+		CHECK(fdt_del_node(fdt, offset));
+		break;
+	}
+}
+
+/* Queue a change in an edit session */
+static void queue_edit(struct fdt_edit *ed, const struct edit *edit)
+{
+	int offset, err;
+
+	offset = fdt_path_offset(ed->fdt, edit->path);
+	if (offset < 0)
+		FAIL("Couldn't find %s: %s", edit->path, fdt_strerror(offset));
+	switch (edit->type) {
+	case FDT_EDIT_SETPROP:
+		CHECK(fdt_edit_setprop(ed, offset, edit->name, edit->val,
+				       strlen(edit->val) + 1));
+		break;
+	case FDT_EDIT_DELPROP:
+		CHECK(fdt_edit_delprop(ed, offset, edit->name));
+		break;
+	case FDT_EDIT_ADD_SUBNODE:
+		CHECK(fdt_edit_add_subnode(ed, offset, edit->name));
+		break;
+	case FDT_EDIT_DEL_NODE:
+		CHECK(fdt_edit_del_node(ed, offset));
+		break;
+	}
+}
+
+static void check_error(const char *what, int err, int expected)
+{
+	if (err != expected)
+		FAIL("%s returned %d (%s) instead of %d (%s)", what, err,
+		     fdt_strerror(err), expected, fdt_strerror(expected));
+}
+
+/* Both trees must be byte-for-byte the same, apart from free space */
+static void check_same(const void *fdt1, const void *fdt2)
+{
+	int size = fdt_off_dt_strings(fdt1) + fdt_size_dt_strings(fdt1);
+
+	if (memcmp(fdt1, fdt2, size) != 0)
+		FAIL("Trees differ");
+}
+
+int main(int argc, char *argv[])
+{
+	struct fdt_edit_op op[MAX_OPS];
+	struct fdt_edit ed;
+	void *fdt, *orig, *seq, *batch;
+	int i, err, node;
+
+	test_init(argc, argv);
+	fdt = load_blob_arg(argc, argv);
+	orig = xmalloc(SPACE);
+	seq = xmalloc(SPACE);
+	batch = xmalloc(SPACE);
+	CHECK(fdt_open_into(fdt, orig, SPACE));
+	CHECK(fdt_open_into(fdt, seq, SPACE));
+	CHECK(fdt_open_into(fdt, batch, SPACE));
+
+	CHECK(fdt_edit_begin(&ed, batch, op, MAX_OPS));
+	for (i = 0; i < ARRAY_SIZE(edits); i++) {
+		do_edit(seq, &edits[i]);
+		queue_edit(&ed, &edits[i]);
+	}
+	check_same(orig, batch);
+	CHECK(fdt_edit_commit(&ed));
+	check_same(seq, batch);
+
+	/* The session continues on the new tree */
+	node = fdt_path_offset(batch, "/subnode@2/subsubnode");
+	CHECK(fdt_edit_setprop(&ed, node, "prop-int", "eleven", 7));
+	CHECK(fdt_edit_commit(&ed));
+	CHECK(fdt_setprop_string(seq, fdt_path_offset(seq,
+			"/subnode@2/subsubnode"), "prop-int", "eleven"));
+	check_same(seq, batch);
+
+	/* Things which fdt_setprop() etc. would not allow */
+	node = fdt_path_offset(batch, "/subnode@2");
+	check_error("fdt_edit_add_subnode()",
+		    fdt_edit_add_subnode(&ed, node, "ss2"), -FDT_ERR_EXISTS);
+	check_error("fdt_edit_add_subnode()",
+		    fdt_edit_add_subnode(&ed, 0, "subnode"), -FDT_ERR_EXISTS);
+	check_error("fdt_edit_delprop()",
+		    fdt_edit_delprop(&ed, node, "no-such-prop"),
+		    -FDT_ERR_NOTFOUND);
+	check_error("fdt_edit_setprop()",
+		    fdt_edit_setprop(&ed, node + 4, "prop", "", 0),
+		    -FDT_ERR_BADOFFSET);
+	CHECK(fdt_edit_add_subnode(&ed, node, "new4"));
+	check_error("fdt_edit_add_subnode()",
+		    fdt_edit_add_subnode(&ed, node, "new4"), -FDT_ERR_EXISTS);
+	CHECK(fdt_edit_del_node(&ed, node));
+	check_error("fdt_edit_setprop()",
+		    fdt_edit_setprop(&ed, node, "prop", "", 0),
+		    -FDT_ERR_BADOFFSET);
+	check_error("fdt_edit_del_node()", fdt_edit_del_node(&ed, node),
+		    -FDT_ERR_BADOFFSET);
+
+	/* Changing the tree behind the session's back */
+	CHECK(fdt_setprop_string(batch, 0, "sneaky", "prop"));
+	check_error("fdt_edit_commit()", fdt_edit_commit(&ed),
+		    -FDT_ERR_BADSTATE);
+
+	/* Running out of space */
+	CHECK(fdt_edit_begin(&ed, batch, op, 1));
+	CHECK(fdt_edit_setprop(&ed, 0, "prop", "", 0));
+	check_error("fdt_edit_setprop()",
+		    fdt_edit_setprop(&ed, 0, "prop2", "", 0),
+		    -FDT_ERR_NOSPACE);
+	fdt_set_totalsize(batch, fdt_off_dt_strings(batch)
+			  + fdt_size_dt_strings(batch));
+	CHECK(fdt_edit_begin(&ed, batch, op, 1));
+	CHECK(fdt_edit_setprop(&ed, 0, "prop3", "", 0));
+	check_error("fdt_edit_commit()", fdt_edit_commit(&ed),
+		    -FDT_ERR_NOSPACE);
+
+	PASS();
+}
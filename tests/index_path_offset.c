@@ -0,0 +1,139 @@
+/*
+ * libfdt - Flat Device Tree manipulation
+ *	Testcase for fdt_index_path_offset() and friends
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libfdt.h>
+
+#include "tests.h"
+#include "testdata.h"
+
+static void check_path(void *fdt, struct fdt_index *index, const char *path)
+{
+	int offset, offset_i, offset_n;
+
+	verbose_printf("Checking \"%s\"...\n", path);
+	offset = fdt_path_offset(fdt, path);
+	offset_i = fdt_index_path_offset(fdt, index, path);
+	offset_n = fdt_index_path_offset(fdt, NULL, path);
+
+	if (offset_i != offset)
+		FAIL("fdt_index_path_offset(\"%s\") returned %d instead of %d",
+		     path, offset_i, offset);
+	if (offset_n != offset)
+		FAIL("fdt_index_path_offset(\"%s\") with no index returned %d"
+		     " instead of %d", path, offset_n, offset);
+}
+
+/* Remove the unit addresses from each component of a path */
+static void strip_unit_addresses(char *path)
+{
+	char *in, *out;
+	int skip = 0;
+
+	for (in = out = path; *in; in++) {
+		if (*in == '@')
+			skip = 1;
+		else if (*in == '/')
+			skip = 0;
+		if (!skip)
+			*out++ = *in;
+	}
+	*out = '\0';
+}
+
+static void check_subnodes(void *fdt, struct fdt_index *index, int parent)
+{
+	const char *name;
+	int offset, offset_i;
+
+	for (offset = fdt_first_subnode(fdt, parent);
+	     offset >= 0;
+	     offset = fdt_next_subnode(fdt, offset)) {
+		name = fdt_get_name(fdt, offset, NULL);
+		offset_i = fdt_index_subnode_offset(fdt, index, parent, name);
+		if (offset_i != fdt_subnode_offset(fdt, parent, name))
+			FAIL("fdt_index_subnode_offset(%d, \"%s\") returned %d"
+			     " instead of %d", parent, name, offset_i,
+			     fdt_subnode_offset(fdt, parent, name));
+	}
+	offset_i = fdt_index_subnode_offset(fdt, index, parent, "nonexistent");
+	if (offset_i != -FDT_ERR_NOTFOUND)
+		FAIL("fdt_index_subnode_offset(%d, \"nonexistent\") returned %d",
+		     parent, offset_i);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fdt_index index;
+	char path[256];
+	void *fdt, *buf;
+	int offset, aliases, size, err;
+	const char *name;
+
+	test_init(argc, argv);
+	fdt = load_blob_arg(argc, argv);
+
+	size = fdt_index_size(fdt);
+	if (size < 0)
+		FAIL("fdt_index_size(): %s", fdt_strerror(size));
+	buf = xmalloc(size);
+	err = fdt_index_build(fdt, &index, buf, size - 1);
+	if (err != -FDT_ERR_NOSPACE)
+		FAIL("fdt_index_build() with short buffer returned %d", err);
+	err = fdt_index_build(fdt, &index, buf, size);
+	if (err)
+		FAIL("fdt_index_build(): %s", fdt_strerror(err));
+
+	for (offset = 0; offset >= 0; offset = fdt_next_node(fdt, offset, NULL)) {
+		err = fdt_get_path(fdt, offset, path, sizeof(path));
+		if (err)
+			FAIL("fdt_get_path(%d): %s", offset, fdt_strerror(err));
+		check_path(fdt, &index, path);
+		if (fdt_index_path_offset(fdt, &index, path) != offset)
+			FAIL("fdt_index_path_offset(\"%s\") is not %d", path,
+			     offset);
+		strip_unit_addresses(path);
+		check_path(fdt, &index, path);
+		check_subnodes(fdt, &index, offset);
+	}
+
+	check_path(fdt, &index, "//");
+	check_path(fdt, &index, "/subnode@1/");
+	check_path(fdt, &index, "//subnode@1///subsubnode");
+	check_path(fdt, &index, "/nonexistent");
+	check_path(fdt, &index, "/subnode@1/nonexistent");
+	check_path(fdt, &index, "nonexistent-alias");
+
+	aliases = fdt_path_offset(fdt, "/aliases");
+	if (aliases >= 0) {
+		for (offset = fdt_first_property_offset(fdt, aliases);
+		     offset >= 0;
+		     offset = fdt_next_property_offset(fdt, offset)) {
+			fdt_getprop_by_offset(fdt, offset, &name, NULL);
+			check_path(fdt, &index, name);
+			snprintf(path, sizeof(path), "%s/subsubnode", name);
+			check_path(fdt, &index, path);
+		}
+	}
+
+	PASS();
+}
@@ -0,0 +1,152 @@
+/*
+ * libfdt - Flat Device Tree manipulation
+ *	Testcase for fdt_node_offset_by_phandle_cache()
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libfdt.h>
+
+#include "tests.h"
+#include "testdata.h"
+
+#define SPACE		65536
+#define PHANDLE_NEW	0x3000
+
+static void check_search(void *fdt, struct fdt_phandle_cache *cache,
+			 uint32_t phandle, int target)
+{
+	int offset;
+
+	offset = fdt_node_offset_by_phandle_cache(fdt, cache, phandle);
+	if (offset != target)
+		FAIL("fdt_node_offset_by_phandle_cache(0x%x) returns %d "
+		     "instead of %d", phandle, offset, target);
+}
+
+/* Check every phandle in the tree against the uncached search */
+static void check_all(void *fdt, struct fdt_phandle_cache *cache)
+{
+	uint32_t phandle;
+	int offset;
+
+	for (offset = fdt_next_node(fdt, -1, NULL);
+	     offset >= 0;
+	     offset = fdt_next_node(fdt, offset, NULL)) {
+		phandle = fdt_get_phandle(fdt, offset);
+		if (phandle)
+			check_search(fdt, cache, phandle,
+				     fdt_node_offset_by_phandle(fdt, phandle));
+	}
+	check_search(fdt, cache, PHANDLE_NEW,
+		     fdt_node_offset_by_phandle(fdt, PHANDLE_NEW));
+}
+
+/* Check the cache against test_tree1, while changing the tree */
+static void check_tree1(void *fdt, struct fdt_phandle_cache *cache)
+{
+	uint32_t phandle = cpu_to_fdt32(PHANDLE_NEW);
+	int subnode1_offset, subnode2_offset, subsubnode2_offset;
+	int err;
+
+	subnode2_offset = fdt_path_offset(fdt, "/subnode@2");
+	subsubnode2_offset = fdt_path_offset(fdt, "/subnode@2/subsubnode@0");
+	if ((subnode2_offset < 0) || (subsubnode2_offset < 0))
+		FAIL("Can't find required nodes");
+
+	check_search(fdt, cache, PHANDLE_1, subnode2_offset);
+	check_search(fdt, cache, PHANDLE_2, subsubnode2_offset);
+	check_search(fdt, cache, ~PHANDLE_1, -FDT_ERR_NOTFOUND);
+	check_search(fdt, NULL, PHANDLE_1, subnode2_offset);
+
+	/* Moving nodes around must not confuse the cache */
+	subnode1_offset = fdt_path_offset(fdt, "/subnode@1");
+	err = fdt_setprop_string(fdt, subnode1_offset, "grow", "moves nodes");
+	if (err)
+		FAIL("fdt_setprop_string(): %s", fdt_strerror(err));
+	check_all(fdt, cache);
+
+	/* Nor should changing a phandle without changing the tree size */
+	subnode2_offset = fdt_path_offset(fdt, "/subnode@2");
+	err = fdt_setprop_inplace(fdt, subnode2_offset, "linux,phandle",
+				  &phandle, sizeof(phandle));
+	if (err)
+		FAIL("fdt_setprop_inplace(): %s", fdt_strerror(err));
+	check_search(fdt, cache, PHANDLE_1, -FDT_ERR_NOTFOUND);
+	check_search(fdt, cache, PHANDLE_NEW, subnode2_offset);
+	check_all(fdt, cache);
+
+	/* Or deleting a node */
+	err = fdt_del_node(fdt, fdt_path_offset(fdt, "/subnode@2"));
+	if (err)
+		FAIL("fdt_del_node(): %s", fdt_strerror(err));
+	check_search(fdt, cache, PHANDLE_NEW, -FDT_ERR_NOTFOUND);
+	check_search(fdt, cache, PHANDLE_2, -FDT_ERR_NOTFOUND);
+	check_all(fdt, cache);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fdt_phandle_cache cache;
+	char name[20];
+	void *fdt, *buf;
+	int size, err;
+	int offset, i;
+
+	test_init(argc, argv);
+	fdt = load_blob_arg(argc, argv);
+	buf = xmalloc(SPACE);
+	err = fdt_open_into(fdt, buf, SPACE);
+	if (err)
+		FAIL("fdt_open_into(): %s", fdt_strerror(err));
+	fdt = buf;
+
+	/* The size returned must be enough, even with no phandles */
+	size = fdt_phandle_cache_size(fdt);
+	if (size < 0)
+		FAIL("fdt_phandle_cache_size(): %s", fdt_strerror(size));
+	buf = xmalloc(size);
+	err = fdt_phandle_cache_build(fdt, &cache, buf, size);
+	if (err)
+		FAIL("fdt_phandle_cache_build(): %s", fdt_strerror(err));
+
+	check_search(fdt, &cache, 0, -FDT_ERR_BADPHANDLE);
+	check_search(fdt, &cache, -1, -FDT_ERR_BADPHANDLE);
+	check_all(fdt, &cache);
+
+	if (fdt_path_offset(fdt, "/subnode@2") >= 0)
+		check_tree1(fdt, &cache);
+
+	/* Add more phandles than the cache can hold */
+	for (i = 1; i <= 8; i++) {
+		snprintf(name, sizeof(name), "extra@%d", i);
+		offset = fdt_add_subnode(fdt, 0, name);
+		if (offset < 0)
+			FAIL("fdt_add_subnode(): %s", fdt_strerror(offset));
+		err = fdt_setprop_cell(fdt, offset, "phandle", PHANDLE_NEW + i);
+		if (err)
+			FAIL("fdt_setprop_cell(): %s", fdt_strerror(err));
+		check_search(fdt, &cache, PHANDLE_NEW + i, offset);
+		check_all(fdt, &cache);
+	}
+	if (!cache.full)
+		FAIL("Cache did not fill up");
+
+	PASS();
+}
@@ -154,6 +154,7 @@ tree1_tests () {
     run_test find_property $TREE
     run_test subnode_offset $TREE
     run_test path_offset $TREE
+    run_test index_path_offset $TREE
     run_test get_name $TREE
     run_test getprop $TREE
     run_test get_phandle $TREE
@@ -194,9 +195,13 @@ ALL_LAYOUTS="mts mst tms tsm smt stm"
 
 libfdt_tests () {
     tree1_tests test_tree1.dtb
+    run_test phandle_cache test_tree1.dtb
+    run_test strhash
+    run_test edit_session test_tree1.dtb
 
     run_dtc_test -I dts -O dtb -o addresses.test.dtb addresses.dts
     run_test addr_size_cells addresses.test.dtb
+    run_test phandle_cache addresses.test.dtb
 
     # Sequential write tests
     run_test sw_tree1
@@ -336,6 +341,7 @@ dtc_tests () {
     run_dtc_test -I dts -O dtb -o aliases.dtb aliases.dts
     run_test get_alias aliases.dtb
     run_test path_offset_aliases aliases.dtb
+    run_test index_path_offset aliases.dtb
 
     # Check /include/ directive
     run_dtc_test -I dts -O dtb -o includes.test.dtb include0.dts
@@ -401,6 +407,24 @@ dtc_tests () {
 	 done
     done
 
+    # Check that --pass-through copies blobs as unflattening them would
+    for tree in dtc_tree1.test.dtb dtc_references.test.dtb \
+	boot_cpuid_17.test.dtb; do
+	run_dtc_test -I dtb -O dtb -V16 -R 2 -p 100 -b 5 -o slow_$tree $tree
+	run_dtc_test -I dtb -O dtb -V16 -R 2 -p 100 -b 5 --pass-through \
+	    -o pass_$tree $tree
+	run_wrap_test cmp pass_$tree slow_$tree
+	run_dtc_test -I dtb -O dtb -S 4096 -o slow17_$tree slow_$tree
+	run_dtc_test -I dtb -O dtb -S 4096 --pass-through -o pass17_$tree \
+	    pass_$tree
+	run_wrap_test cmp pass17_$tree slow17_$tree
+    done
+    for tree in v17.smt.test_tree1.dtb v16.mts.test_tree1.dtb \
+	ov1_test_tree1.dtb.test.dtb; do
+	run_dtc_test -I dtb -O dtb --pass-through -o pass_$tree $tree
+	run_test dtbs_equal_ordered pass_$tree test_tree1.dtb
+    done
+
     # Check merge/overlay functionality
     run_dtc_test -I dts -O dtb -o dtc_tree1_merge.test.dtb test_tree1_merge.dts
     tree1_tests dtc_tree1_merge.test.dtb test_tree1.dtb
@@ -462,6 +486,120 @@ dtc_tests () {
     run_sh_test dtc-fails.sh -n test-negation-4.test.dtb -Esize_cells_is_cell -Eno_size_cells_is_cell -I dts -O dtb bad-ncells.dts
     run_sh_test dtc-checkfails.sh size_cells_is_cell -- -Esize_cells_is_cell -Eno_size_cells_is_cell -I dts -O dtb bad-ncells.dts
 
+    # Running the checks on several threads must not change anything
+    run_sh_test dtc-checkfails.sh address_cells_is_cell size_cells_is_cell interrupt_cells_is_cell -- -j 4 -I dts -O dtb bad-ncells.dts
+    run_sh_test dtc-checkfails.sh reg_format ranges_format -- -j 4 -I dts -O dtb bad-reg-ranges.dts
+    run_dtc_test -j 4 -I dts -O dtb -o dtc_tree1_j4.test.dtb test_tree1.dts
+    run_wrap_test cmp dtc_tree1_j4.test.dtb dtc_tree1.test.dtb
+    for tree in test_tree1.dts references.dts; do
+	run_dtc_test -V16 -I dts -O dtb -o v16_$tree.test.dtb $tree
+	run_dtc_test -j 3 -V16 -I dts -O dtb -o v16_j3_$tree.test.dtb $tree
+	run_wrap_test cmp v16_j3_$tree.test.dtb v16_$tree.test.dtb
+    done
+    run_dtc_test --check-stats text -I dts -O dtb -o dtc_tree1_stats.test.dtb test_tree1.dts
+    run_wrap_test cmp dtc_tree1_stats.test.dtb dtc_tree1.test.dtb
+    run_dtc_test --check-stats json -I dts -O dtb -o dtc_tree1_stats.test.dtb test_tree1.dts
+    # Checks after the first error are not run, nor listed
+    for j in 1 3; do
+	run_wrap_test sh -c "$DTC -j $j -f --check-stats text -I dts -O dtb \
+	    -o /dev/null dup-nodename.dts 2>&1 | \
+	    grep -A2 '^Check ' | tail -n +2 | cut -d' ' -f1 | \
+	    tr '\\n' '|' | grep -qx 'duplicate_node_names||'"
+    done
+
+    # Compiling several files in one run must give the same results
+    run_dtc_test -I dts -O dtb -o batch_board1.test.dtb batch_board1.dts
+    run_dtc_test -I dts -O dtb -o batch_board2.test.dtb batch_board2.dts
+    run_dtc_test -I dts -O dtb --batch dtc-batch.txt
+    run_wrap_test cmp batch_board1_b.test.dtb batch_board1.test.dtb
+    run_wrap_test cmp batch_board2_b.test.dtb batch_board2.test.dtb
+    run_wrap_test cmp batch_include0_b.test.dtb includes.test.dtb
+    run_wrap_test cmp batch_board1_c.test.dtb batch_board1.test.dtb
+    run_sh_test dtc-fails.sh batch_board1_d.test.dtb --batch dtc-batch.txt -I dts -O dtb
+    # An input which fails stops the batch, and messages say which it was
+    rm -f batch_board2_f.test.dtb
+    run_wrap_error_test sh -c "$DTC -I dts -O dtb --batch dtc-batch-fail.txt \
+	2> tmp.batch.err"
+    run_wrap_test test ! -e batch_board2_f.test.dtb
+    run_wrap_test grep -q "^bad-ncells.dts: Warning (address_cells_is_cell)" \
+	tmp.batch.err
+    run_wrap_test grep -q "^dup-nodename.dts: ERROR (duplicate_node_names)" \
+	tmp.batch.err
+    run_wrap_test grep -q "stopped at dup-nodename.dts" tmp.batch.err
+
+    # So must precompiled include files, unless they are no good
+    run_dtc_test --precompile batch_soc.dtsi
+    run_dtc_test -I dts -O dtb -o batch_board1_p.test.dtb batch_board1.dts
+    run_wrap_test cmp batch_board1_p.test.dtb batch_board1.test.dtb
+    run_dtc_test -I dts -O dtb --batch dtc-batch.txt
+    run_wrap_test cmp batch_board2_b.test.dtb batch_board2.test.dtb
+    echo "not a precompiled file" > batch_soc.dtsi.pdt
+    run_dtc_test -I dts -O dtb -o batch_board1_p.test.dtb batch_board1.dts
+    run_wrap_test cmp batch_board1_p.test.dtb batch_board1.test.dtb
+    # Move the first phandle reference so that it runs off its value
+    run_dtc_test --precompile batch_soc.dtsi
+    LC_ALL=C sed 's/\xff\xff\xff\xff\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00/\xff\xff\xff\xff\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x02/' \
+	batch_soc.dtsi.pdt > tmp.batch_soc.pdt
+    run_wrap_test sh -c "! cmp -s tmp.batch_soc.pdt batch_soc.dtsi.pdt"
+    mv tmp.batch_soc.pdt batch_soc.dtsi.pdt
+    run_dtc_test -I dts -O dtb -o batch_board1_p.test.dtb batch_board1.dts
+    run_wrap_test cmp batch_board1_p.test.dtb batch_board1.test.dtb
+    rm -f batch_soc.dtsi.pdt
+    # Its includes must find what they would with the search path given now
+    run_dtc_test -i search_dir -I dts -O dtb -o search_soc.test.dtb \
+	search_soc.dts
+    run_dtc_test -i search_dir_b -I dts -O dtb -o search_soc_b.test.dtb \
+	search_soc.dts
+    run_dtc_test -i search_dir --precompile search_soc.dtsi
+    run_dtc_test -i search_dir_b -I dts -O dtb -o search_soc_p.test.dtb \
+	search_soc.dts
+    run_wrap_test cmp search_soc_p.test.dtb search_soc_b.test.dtb
+    run_dtc_test -i search_dir -I dts -O dtb -o search_soc_p.test.dtb \
+	search_soc.dts
+    run_wrap_test cmp search_soc_p.test.dtb search_soc.test.dtb
+    rm -f search_soc.dtsi.pdt
+
+    # And so must a compile server's, as the files it has parsed change
+    rm -f tmp.dtc-server
+    run_wrap_error_test $DTC -W no-reg_format --server tmp.dtc-server
+    run_wrap_error_test $DTC --server tmp.dtc-server -j 2
+    $DTC --server tmp.dtc-server &
+    server=$!
+    for i in $(seq 50); do
+	[ -S tmp.dtc-server ] && break
+	sleep 0.1
+    done
+    sed s/batch_soc.dtsi/tmp.server_soc.dtsi/ batch_board1.dts \
+	> tmp.server_board.dts
+    cp batch_soc.dtsi tmp.server_soc.dtsi
+    for change in none touch edit; do
+	case $change in
+	    touch) touch tmp.server_soc.dtsi ;;
+	    edit) echo '&uart1 { status = "okay"; };' >> tmp.server_soc.dtsi ;;
+	esac
+	run_dtc_test -I dts -O dtb -o tmp.server.dtb -d tmp.server.d \
+	    tmp.server_board.dts
+	mv tmp.server.dtb tmp.local.dtb
+	mv tmp.server.d tmp.local.d
+	export DTC_SERVER=tmp.dtc-server
+	run_dtc_test -I dts -O dtb -o tmp.server.dtb -d tmp.server.d \
+	    tmp.server_board.dts
+	run_wrap_test cmp tmp.server.dtb tmp.local.dtb
+	run_wrap_test cmp tmp.server.d tmp.local.d
+	run_sh_test dtc-fails.sh tmp.server_fail.dtb -I dts -O dtb \
+	    nonexistent.dts
+	unset DTC_SERVER
+    done
+    # Its fragments' includes must find what they would with -i given now
+    export DTC_SERVER=tmp.dtc-server
+    for dir in search_dir search_dir_b search_dir; do
+	run_dtc_test -i $dir -I dts -O dtb -o tmp.server.dtb search_soc.dts
+	run_wrap_test cmp tmp.server.dtb search_soc${dir#search_dir}.test.dtb
+    done
+    unset DTC_SERVER
+    kill $server
+    rm -f tmp.dtc-server
+
     # Check for proper behaviour reading from stdin
     run_dtc_test -I dts -O dtb -o stdin_dtc_tree1.test.dtb - < test_tree1.dts
     run_wrap_test cmp stdin_dtc_tree1.test.dtb dtc_tree1.test.dtb
@@ -565,6 +703,21 @@ fdtget_tests () {
     run_fdtget_test "<the dead silence>" -tx \
 	-d "<the dead silence>" $dtb /randomnode doctor-who
     run_fdtget_test "<blink>" -tx -d "<blink>" $dtb /memory doctor-who
+
+    # Test batch mode: a failed query is an error, but does not stop the
+    # rest, and gives an empty (or default) result
+    run_wrap_error_test $DTGET -b fdtget-batch.txt $dtb
+    run_fdtget_test "MyBoardName\n32768\n-\nmemory\nmemory\n-" \
+	-d - -b fdtget-batch.txt $dtb
+    run_fdtget_test "bootargs\nlinux,platform" -p -b fdtget-batch-nodes.txt $dtb
+    run_wrap_test sh -c "echo '/ model' | $DTGET -z -b - $dtb | \
+	tr '\\000' '|' | grep -qx 'MyBoardName|'"
+
+    # An unterminated quote is an error on that line only
+    printf '/ model\n/ "model\n/ model\n' > tmp.fdtget-batch-quote.txt
+    run_wrap_error_test $DTGET -b tmp.fdtget-batch-quote.txt $dtb
+    run_wrap_test sh -c "$DTGET -b tmp.fdtget-batch-quote.txt $dtb | \
+	tr '\\n' '|' | grep -qx 'MyBoardName||MyBoardName|'"
 }
 
 fdtput_tests () {
@@ -641,11 +794,31 @@ fdtput_tests () {
     # Delete the non-existent property
     run_wrap_error_test $DTPUT $dtb -d /chosen   non-existent-prop
 
+    # Start again with a fresh, packed dtb
+    run_dtc_test -O dtb -o $dtb $dts
+
+    # Batch mode
+    run_wrap_test $DTPUT $dtb -b fdtput-batch.txt
+    run_fdtget_test "batch model" $dtb / model
+    run_fdtget_test "1234" -tx $dtb /cpus/PowerPC,970@1 d-cache-size
+    run_fdtget_test "first node" $dtb /batch/node1 name
+    run_fdtget_test "1000" $dtb /batch/node3 cost
+    run_fdtget_test "one two three four five" $dtb /batch/node3 words
+    run_fdtget_test "node3\nnode1" $dtb -l /batch
+    run_fdtget_test "linux,platform" $dtb -p /chosen
+    run_wrap_test sh -c "echo '-ts /batch bar baz' | $DTPUT $dtb -b -"
+    run_fdtget_test "baz" $dtb /batch bar
+
+    # Nothing is written if a command fails
+    run_wrap_error_test $DTPUT $dtb -b fdtput-batch-bad.txt
+    run_fdtget_test "batch model" $dtb / model
+    run_wrap_error_test $DTPUT $dtb -b fdtput-batch.txt /chosen
+
     # TODO: Add tests for verbose mode?
 }
 
 utilfdt_tests () {
-    run_test utilfdt_test
+    run_test utilfdt_test test_tree1.dtb
 }
 
 fdtdump_tests () {
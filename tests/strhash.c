@@ -0,0 +1,154 @@
+/*
+ * libfdt - Flat Device Tree manipulation
+ *	Testcase for fdt_property_strhash() and fdt_setprop_strhash()
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libfdt.h>
+
+#include "tests.h"
+#include "testdata.h"
+
+#define SPACE		65536
+#define NUM_NODES	20
+#define NUM_NAMES	50
+#define NUM_SLOTS	64	/* too small to hold every name */
+
+#define CHECK(code) \
+	{ \
+		err = (code); \
+		if (err) \
+			FAIL(#code ": %s", fdt_strerror(err)); \
+	}
+
+static void prop_name(char *name, int i)
+{
+	sprintf(name, "prop-%d", i);
+}
+
+/* Check that every node has every property, with the expected value */
+static void check_tree(void *fdt)
+{
+	char name[20], nodename[20];
+	int i, j, node;
+
+	for (i = 0; i < NUM_NODES; i++) {
+		sprintf(nodename, "/node%d", i);
+		node = fdt_path_offset(fdt, nodename);
+		if (node < 0)
+			FAIL("Couldn't find %s: %s", nodename,
+			     fdt_strerror(node));
+		for (j = 0; j < NUM_NAMES; j++) {
+			prop_name(name, j);
+			check_getprop_cell(fdt, node, name, i * NUM_NAMES + j);
+		}
+	}
+}
+
+/* Check that no property name was added to the string block twice */
+static void check_strings(void *fdt)
+{
+	const char *strtab = (const char *)fdt + fdt_off_dt_strings(fdt);
+	const char *p, *q, *end = strtab + fdt_size_dt_strings(fdt);
+
+	for (p = strtab; p < end; p += strlen(p) + 1)
+		for (q = p + strlen(p) + 1; q < end; q += strlen(q) + 1)
+			if (streq(p, q))
+				FAIL("String '%s' appears twice", p);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fdt_strhash sh;
+	int32_t slot[NUM_SLOTS];
+	char name[20], nodename[20];
+	void *fdt, *sw, *buf;
+	int i, j, node, err;
+
+	test_init(argc, argv);
+
+	if (fdt_strhash_init(&sh, slot, 1) != -FDT_ERR_NOSPACE)
+		FAIL("fdt_strhash_init() accepted a single slot");
+
+	/* Build a tree using the sequential-write functions */
+	sw = xmalloc(SPACE);
+	CHECK(fdt_strhash_init(&sh, slot, NUM_SLOTS));
+	CHECK(fdt_create(sw, SPACE));
+	CHECK(fdt_finish_reservemap(sw));
+	CHECK(fdt_begin_node(sw, ""));
+	for (i = 0; i < NUM_NODES; i++) {
+		sprintf(nodename, "node%d", i);
+		CHECK(fdt_begin_node(sw, nodename));
+		for (j = 0; j < NUM_NAMES; j++) {
+			uint32_t val = cpu_to_fdt32(i * NUM_NAMES + j);
+
+			prop_name(name, j);
+			CHECK(fdt_property_strhash(sw, &sh, name, &val,
+						   sizeof(val)));
+		}
+		CHECK(fdt_end_node(sw));
+	}
+	CHECK(fdt_end_node(sw));
+	CHECK(fdt_finish(sw));
+	check_tree(sw);
+	check_strings(sw);
+
+	/* Build the same tree again, this time in read-write mode */
+	fdt = xmalloc(SPACE);
+	buf = xmalloc(SPACE);
+	CHECK(fdt_create(buf, SPACE));
+	CHECK(fdt_finish_reservemap(buf));
+	CHECK(fdt_begin_node(buf, ""));
+	CHECK(fdt_end_node(buf));
+	CHECK(fdt_finish(buf));
+	CHECK(fdt_open_into(buf, fdt, SPACE));
+	CHECK(fdt_strhash_init(&sh, slot, NUM_SLOTS));
+	for (i = 0; i < NUM_NODES; i++) {
+		sprintf(nodename, "node%d", i);
+		node = fdt_add_subnode(fdt, 0, nodename);
+		if (node < 0)
+			FAIL("fdt_add_subnode(): %s", fdt_strerror(node));
+		for (j = 0; j < NUM_NAMES; j++) {
+			uint32_t val = cpu_to_fdt32(i * NUM_NAMES + j);
+
+			prop_name(name, j);
+			CHECK(fdt_setprop_strhash(fdt, &sh, node, name, &val,
+						  sizeof(val)));
+		}
+	}
+	check_tree(fdt);
+	check_strings(fdt);
+
+	/* Moving the tree must not confuse the hash */
+	CHECK(fdt_open_into(fdt, buf, SPACE));
+	node = fdt_path_offset(buf, "/node0");
+	CHECK(fdt_setprop_strhash(buf, &sh, node, "new-prop", "", 0));
+	CHECK(fdt_setprop_strhash(buf, &sh, node, "prop-0", "", 0));
+	check_strings(buf);
+	if (!fdt_getprop(buf, node, "new-prop", NULL))
+		FAIL("new-prop not added");
+
+	/* Nor must changing the string block behind its back */
+	CHECK(fdt_setprop(buf, node, "other-prop", "", 0));
+	CHECK(fdt_setprop_strhash(buf, &sh, node, "other-prop", "", 0));
+	check_strings(buf);
+
+	PASS();
+}
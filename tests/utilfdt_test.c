@@ -120,8 +120,36 @@ static void test_utilfdt_decode_type(void)
 			"I admire.");
 }
 
+/* Read a blob both ways and check that we get the whole file each time */
+static void test_utilfdt_map(const char *filename)
+{
+	char *read_buf, *map_buf;
+	off_t read_len, map_len;
+
+	read_buf = utilfdt_read_len(filename, &read_len);
+	if (!read_buf)
+		FAIL("Couldn't read '%s'", filename);
+	if (read_len != fdt_totalsize(read_buf))
+		FAIL("utilfdt_read_len() returned size %d instead of %d",
+		     (int)read_len, fdt_totalsize(read_buf));
+
+	map_buf = utilfdt_map(filename, &map_len);
+	if (!map_buf)
+		FAIL("Couldn't map '%s'", filename);
+	if (map_len != read_len)
+		FAIL("utilfdt_map() returned size %d instead of %d",
+		     (int)map_len, (int)read_len);
+	if (memcmp(map_buf, read_buf, read_len))
+		FAIL("Mapped blob differs from the one read");
+
+	utilfdt_unmap(map_buf);
+	utilfdt_unmap(read_buf);
+}
+
 int main(int argc, char *argv[])
 {
 	test_utilfdt_decode_type();
+	if (argc > 1)
+		test_utilfdt_map(argv[1]);
 	PASS();
 }
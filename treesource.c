@@ -21,37 +21,295 @@
 #include "dtc.h"
 #include "srcpos.h"
 
-extern FILE *yyin;
-extern int yyparse(void);
-extern YYLTYPE yylloc;
+extern int yyparse(struct parse_context *ctx);
 
-struct boot_info *the_boot_info;
-bool treesource_error;
+bool cache_includes;
+
+/* Every fragment parsed or loaded so far, including those which failed */
+struct fragment *fragment_cache;
+
+/* Open a file and set up to parse it, as a whole source file or a fragment */
+static void parse_start(struct parse_context *ctx, const char *fname,
+			bool fragment)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	srcfile_push(&ctx->srcfile, fname);
+	lexer_init(ctx, fragment);
+}
 
 struct boot_info *dt_from_source(const char *fname)
 {
-	the_boot_info = NULL;
-	treesource_error = false;
+	struct parse_context ctx;
 
-	srcfile_push(fname);
-	yyin = current_srcfile->f;
-	yylloc.file = current_srcfile;
+	parse_start(&ctx, fname, false);
 
-	if (yyparse() != 0)
+	if (yyparse(&ctx) != 0)
 		die("Unable to parse input tree\n");
 
-	if (treesource_error)
+	if (ctx.error)
 		die("Syntax error parsing input tree\n");
 
-	return the_boot_info;
+	lexer_destroy(&ctx);
+	return ctx.boot_info;
+}
+
+struct fragment_op *build_fragment_op(enum fragment_op_type type, char *label,
+				      char *ref, struct node *node,
+				      struct srcpos *srcpos)
+{
+	struct fragment_op *new = xmalloc(sizeof(*new));
+
+	memset(new, 0, sizeof(*new));
+	new->type = type;
+	new->label = label;
+	new->ref = ref;
+	new->node = node;
+	new->srcpos = srcpos_copy(srcpos);
+
+	return new;
+}
+
+struct fragment_op *chain_fragment_op(struct fragment_op *first,
+				      struct fragment_op *list)
+{
+	assert(first->next == NULL);
+
+	first->next = list;
+	return first;
+}
+
+static struct fragment *new_fragment(void)
+{
+	struct fragment *f = xmalloc(sizeof(*f));
+
+	memset(f, 0, sizeof(*f));
+	f->deps = xmalloc(sizeof(*f->deps));
+	memset(f->deps, 0, sizeof(*f->deps));
+	f->search_path = srcfile_search_path();
+
+	return f;
 }
 
-static void write_prefix(FILE *f, int level)
+/*
+ * Look for a fragment parsed earlier, or else a precompiled one. Either
+ * must have been made with the same search path, if it includes anything.
+ */
+struct fragment *find_fragment(const char *name)
+{
+	struct fragment *f;
+
+	for (f = fragment_cache; f; f = f->next)
+		if (streq(f->name, name) && !fragment_path_changed(f))
+			return f;
+
+	f = load_precompiled(name);
+	if (f) {
+		f->next = fragment_cache;
+		fragment_cache = f;
+	}
+
+	return f;
+}
+
+/*
+ * Parse the file which the lexer has just started reading as a fragment.
+ * Nothing is printed: if the file is not just a list of top-level
+ * statements, or if it has any problems, the fragment is marked as failed
+ * and the caller reads the file as text instead, which reports them. The
+ * files read are noted in the fragment rather than in depfile, for the
+ * same reason. The outer parse's state in ctx is left as it was.
+ */
+struct fragment *parse_fragment(struct parse_context *ctx, const char *name)
+{
+	struct fragment *f = new_fragment();
+	struct fragment_op *ops = ctx->fragment_ops;
+	bool error = ctx->error, arena = arena_enabled;
+	bool was_quiet = srcpos_quiet;
+	int quiet_count = srcpos_quiet_count;
+	struct dep_list *deps = dep_list;
+	FILE *deps_file = depfile;
+
+	/* Fragments outlive the tree they are first included in */
+	arena_enabled = false;
+	ctx->error = false;
+	srcpos_quiet = true;
+	srcpos_quiet_count = 0;
+	dep_list = f->deps;
+	depfile = NULL;
+	ctx->fragment_ops = NULL;
+
+	f->name = xstrdup(name);
+	srcfile_add_dependency(name);
+	f->failed = yyparse(ctx) || ctx->error || srcpos_quiet_count;
+	f->ops = ctx->fragment_ops;
+	f->next = fragment_cache;
+	fragment_cache = f;
+
+	arena_enabled = arena;
+	ctx->fragment_ops = ops;
+	ctx->error = error;
+	srcpos_quiet = was_quiet;
+	srcpos_quiet_count = quiet_count;
+	dep_list = deps;
+	depfile = deps_file;
+
+	return f;
+}
+
+/*
+ * Parse a whole file as a fragment, to be precompiled. Unlike
+ * parse_fragment(), any problems are reported, and are fatal.
+ */
+struct fragment *fragment_from_source(const char *fname)
+{
+	struct fragment *f = new_fragment();
+	struct parse_context ctx;
+
+	dep_list = f->deps;
+	parse_start(&ctx, fname, true);
+	f->name = xstrdup(ctx.srcfile->name);
+
+	if (yyparse(&ctx) != 0)
+		die("Unable to parse input file\n");
+
+	if (ctx.error)
+		die("Syntax error parsing input file\n");
+
+	lexer_destroy(&ctx);
+	dep_list = NULL;
+	f->ops = ctx.fragment_ops;
+	return f;
+}
+
+/* Whether a fragment can be used before the root node has been defined */
+bool fragment_starts_tree(struct fragment *f)
+{
+	struct fragment_op *op;
+
+	for (op = f->ops; op; op = op->next) {
+		if (op->type != FRAGMENT_INCLUDE)
+			return op->type == FRAGMENT_ROOT;
+		if (op->include->ops)
+			return fragment_starts_tree(op->include);
+	}
+
+	return false;
+}
+
+/*
+ * Make the changes a fragment describes to a tree, as the parser would have
+ * done had it read the file. The tree may only be NULL if
+ * fragment_starts_tree() is true. Errors are noted in ctx.
+ */
+struct node *apply_fragment(struct parse_context *ctx, struct node *tree,
+			    struct fragment *f)
+{
+	struct fragment_op *op;
+	struct node *target;
+
+	for (op = f->ops; op; op = op->next) {
+		switch (op->type) {
+		case FRAGMENT_ROOT:
+			if (tree)
+				tree = merge_nodes(tree, copy_node(op->node));
+			else
+				tree = name_node(copy_node(op->node), "");
+			break;
+
+		case FRAGMENT_INCLUDE:
+			tree = apply_fragment(ctx, tree, op->include);
+			break;
+
+		case FRAGMENT_REF:
+		case FRAGMENT_DELETE:
+			assert(tree);
+			target = get_node_by_ref(tree, op->ref);
+			if (!target) {
+				srcpos_error(op->srcpos, "Error",
+					     "Label or path %s not found",
+					     op->ref);
+				ctx->error = true;
+			} else if (op->type == FRAGMENT_DELETE) {
+				delete_node(target);
+			} else {
+				if (op->label)
+					add_label(&target->labels,
+						  arena_strdup(op->label));
+				merge_nodes(target, copy_node(op->node));
+			}
+			break;
+		}
+	}
+
+	return tree;
+}
+
+/*
+ * Source is written a piece at a time into a buffer, and the buffer to
+ * the file as it fills, rather than with a stdio call for every byte or
+ * cell of a value. Hex is formatted by hand, to the same effect as the
+ * printf() formats noted.
+ */
+#define OUTBUF_SIZE	65536
+
+struct outbuf {
+	FILE *f;
+	int len;
+	char buf[OUTBUF_SIZE];
+};
+
+static void out_flush(struct outbuf *ob)
+{
+	fwrite(ob->buf, 1, ob->len, ob->f);
+	ob->len = 0;
+}
+
+static void out_mem(struct outbuf *ob, const char *p, int len)
+{
+	if (ob->len + len > OUTBUF_SIZE) {
+		out_flush(ob);
+		if (len > OUTBUF_SIZE) {
+			fwrite(p, 1, len, ob->f);
+			return;
+		}
+	}
+	memcpy(ob->buf + ob->len, p, len);
+	ob->len += len;
+}
+
+static void out_str(struct outbuf *ob, const char *str)
+{
+	out_mem(ob, str, strlen(str));
+}
+
+static void out_char(struct outbuf *ob, char c)
+{
+	if (ob->len == OUTBUF_SIZE)
+		out_flush(ob);
+	ob->buf[ob->len++] = c;
+}
+
+/* As "%0*llx", with at least @digits digits */
+static void out_hex(struct outbuf *ob, uint64_t val, int digits)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	char hex[16];
+	int n = 0;
+
+	do {
+		hex[sizeof(hex) - ++n] = hexdigits[val & 0xf];
+		val >>= 4;
+	} while (val || n < digits);
+
+	out_mem(ob, hex + sizeof(hex) - n, n);
+}
+
+static void write_prefix(struct outbuf *ob, int level)
 {
 	int i;
 
 	for (i = 0; i < level; i++)
-		fputc('\t', f);
+		out_char(ob, '\t');
 }
 
 static bool isstring(char c)
@@ -61,7 +319,25 @@ static bool isstring(char c)
 		|| strchr("\a\b\t\n\v\f\r", c));
 }
 
-static void write_propval_string(FILE *f, struct data val)
+static void write_label(struct outbuf *ob, const char *label)
+{
+	out_str(ob, label);
+	out_mem(ob, ": ", 2);
+}
+
+/* Wrap up any labels at the end of a value */
+static void write_end_labels(struct outbuf *ob, struct data val,
+			     struct marker *m)
+{
+	for_each_marker_of_type(m, LABEL) {
+		assert (m->offset == val.len);
+		out_char(ob, ' ');
+		out_str(ob, m->ref);
+		out_char(ob, ':');
+	}
+}
+
+static void write_propval_string(struct outbuf *ob, struct data val)
 {
 	const char *str = val.val;
 	int i;
@@ -71,128 +347,122 @@ static void write_propval_string(FILE *f, struct data val)
 
 	while (m && (m->offset == 0)) {
 		if (m->type == LABEL)
-			fprintf(f, "%s: ", m->ref);
+			write_label(ob, m->ref);
 		m = m->next;
 	}
-	fprintf(f, "\"");
+	out_char(ob, '"');
 
 	for (i = 0; i < (val.len-1); i++) {
 		char c = str[i];
 
 		switch (c) {
 		case '\a':
-			fprintf(f, "\\a");
+			out_mem(ob, "\\a", 2);
 			break;
 		case '\b':
-			fprintf(f, "\\b");
+			out_mem(ob, "\\b", 2);
 			break;
 		case '\t':
-			fprintf(f, "\\t");
+			out_mem(ob, "\\t", 2);
 			break;
 		case '\n':
-			fprintf(f, "\\n");
+			out_mem(ob, "\\n", 2);
 			break;
 		case '\v':
-			fprintf(f, "\\v");
+			out_mem(ob, "\\v", 2);
 			break;
 		case '\f':
-			fprintf(f, "\\f");
+			out_mem(ob, "\\f", 2);
 			break;
 		case '\r':
-			fprintf(f, "\\r");
+			out_mem(ob, "\\r", 2);
 			break;
 		case '\\':
-			fprintf(f, "\\\\");
+			out_mem(ob, "\\\\", 2);
 			break;
 		case '\"':
-			fprintf(f, "\\\"");
+			out_mem(ob, "\\\"", 2);
 			break;
 		case '\0':
-			fprintf(f, "\", ");
+			out_mem(ob, "\", ", 3);
 			while (m && (m->offset <= (i + 1))) {
 				if (m->type == LABEL) {
 					assert(m->offset == (i+1));
-					fprintf(f, "%s: ", m->ref);
+					write_label(ob, m->ref);
 				}
 				m = m->next;
 			}
-			fprintf(f, "\"");
+			out_char(ob, '"');
 			break;
 		default:
-			if (isprint((unsigned char)c))
-				fprintf(f, "%c", c);
-			else
-				fprintf(f, "\\x%02hhx", c);
+			if (isprint((unsigned char)c)) {
+				out_char(ob, c);
+			} else {
+				/* "\\x%02hhx" */
+				out_mem(ob, "\\x", 2);
+				out_hex(ob, (unsigned char)c, 2);
+			}
 		}
 	}
-	fprintf(f, "\"");
+	out_char(ob, '"');
 
-	/* Wrap up any labels at the end of the value */
-	for_each_marker_of_type(m, LABEL) {
-		assert (m->offset == val.len);
-		fprintf(f, " %s:", m->ref);
-	}
+	write_end_labels(ob, val, m);
 }
 
-static void write_propval_cells(FILE *f, struct data val)
+static void write_propval_cells(struct outbuf *ob, struct data val)
 {
 	void *propend = val.val + val.len;
 	cell_t *cp = (cell_t *)val.val;
 	struct marker *m = val.markers;
 
-	fprintf(f, "<");
+	out_char(ob, '<');
 	for (;;) {
 		while (m && (m->offset <= ((char *)cp - val.val))) {
 			if (m->type == LABEL) {
 				assert(m->offset == ((char *)cp - val.val));
-				fprintf(f, "%s: ", m->ref);
+				write_label(ob, m->ref);
 			}
 			m = m->next;
 		}
 
-		fprintf(f, "0x%x", fdt32_to_cpu(*cp++));
+		/* "0x%x" */
+		out_mem(ob, "0x", 2);
+		out_hex(ob, fdt32_to_cpu(*cp++), 1);
 		if ((void *)cp >= propend)
 			break;
-		fprintf(f, " ");
+		out_char(ob, ' ');
 	}
 
-	/* Wrap up any labels at the end of the value */
-	for_each_marker_of_type(m, LABEL) {
-		assert (m->offset == val.len);
-		fprintf(f, " %s:", m->ref);
-	}
-	fprintf(f, ">");
+	write_end_labels(ob, val, m);
+	out_char(ob, '>');
 }
 
-static void write_propval_bytes(FILE *f, struct data val)
+static void write_propval_bytes(struct outbuf *ob, struct data val)
 {
 	void *propend = val.val + val.len;
 	const char *bp = val.val;
 	struct marker *m = val.markers;
 
-	fprintf(f, "[");
+	out_char(ob, '[');
 	for (;;) {
 		while (m && (m->offset == (bp-val.val))) {
 			if (m->type == LABEL)
-				fprintf(f, "%s: ", m->ref);
+				write_label(ob, m->ref);
 			m = m->next;
 		}
 
-		fprintf(f, "%02hhx", (unsigned char)(*bp++));
+		/* "%02hhx" */
+		out_hex(ob, (unsigned char)(*bp++), 2);
 		if ((const void *)bp >= propend)
 			break;
-		fprintf(f, " ");
+		out_char(ob, ' ');
 	}
 
-	/* Wrap up any labels at the end of the value */
-	for_each_marker_of_type(m, LABEL) {
-		assert (m->offset == val.len);
-		fprintf(f, " %s:", m->ref);
-	}
-	fprintf(f, "]");
+	write_end_labels(ob, val, m);
+	out_char(ob, ']');
 }
 
-static void write_propval(FILE *f, struct property *prop)
+static void write_propval(struct outbuf *ob, struct property *prop)
 {
 	int len = prop->val.len;
 	const char *p = prop->val.val;
@@ -202,7 +472,7 @@ static void write_propval(FILE *f, struct property *prop)
 	int i;
 
 	if (len == 0) {
-		fprintf(f, ";\n");
+		out_mem(ob, ";\n", 2);
 		return;
 	}
 
@@ -220,65 +490,79 @@ static void write_propval(FILE *f, struct property *prop)
 			nnotcelllbl++;
 	}
 
-	fprintf(f, " = ");
+	out_mem(ob, " = ", 3);
 	if ((p[len-1] == '\0') && (nnotstring == 0) && (nnul < (len-nnul))
 	    && (nnotstringlbl == 0)) {
-		write_propval_string(f, prop->val);
+		write_propval_string(ob, prop->val);
 	} else if (((len % sizeof(cell_t)) == 0) && (nnotcelllbl == 0)) {
-		write_propval_cells(f, prop->val);
+		write_propval_cells(ob, prop->val);
 	} else {
-		write_propval_bytes(f, prop->val);
+		write_propval_bytes(ob, prop->val);
 	}
 
-	fprintf(f, ";\n");
+	out_mem(ob, ";\n", 2);
 }
 
-static void write_tree_source_node(FILE *f, struct node *tree, int level)
+static void write_tree_source_node(struct outbuf *ob, struct node *tree,
+				   int level)
 {
 	struct property *prop;
 	struct node *child;
 	struct label *l;
 
-	write_prefix(f, level);
+	write_prefix(ob, level);
 	for_each_label(tree->labels, l)
-		fprintf(f, "%s: ", l->label);
-	if (tree->name && (*tree->name))
-		fprintf(f, "%s {\n", tree->name);
-	else
-		fprintf(f, "/ {\n");
+		write_label(ob, l->label);
+	if (tree->name && (*tree->name)) {
+		out_str(ob, tree->name);
+		out_mem(ob, " {\n", 3);
+	} else {
+		out_mem(ob, "/ {\n", 4);
+	}
 
 	for_each_property(tree, prop) {
-		write_prefix(f, level+1);
+		write_prefix(ob, level+1);
 		for_each_label(prop->labels, l)
-			fprintf(f, "%s: ", l->label);
-		fprintf(f, "%s", prop->name);
-		write_propval(f, prop);
+			write_label(ob, l->label);
+		out_str(ob, prop->name);
+		write_propval(ob, prop);
 	}
 	for_each_child(tree, child) {
-		fprintf(f, "\n");
-		write_tree_source_node(f, child, level+1);
+		out_char(ob, '\n');
+		write_tree_source_node(ob, child, level+1);
 	}
-	write_prefix(f, level);
-	fprintf(f, "};\n");
+	write_prefix(ob, level);
+	out_mem(ob, "};\n", 3);
 }
 
 
 void dt_to_source(FILE *f, struct boot_info *bi)
 {
 	struct reserve_info *re;
+	struct outbuf *ob;
+
+	ob = xmalloc(sizeof(*ob));
+	ob->f = f;
+	ob->len = 0;
 
-	fprintf(f, "/dts-v1/;\n\n");
+	out_str(ob, "/dts-v1/;\n\n");
 
 	for (re = bi->reservelist; re; re = re->next) {
 		struct label *l;
 
 		for_each_label(re->labels, l)
-			fprintf(f, "%s: ", l->label);
-		fprintf(f, "/memreserve/\t0x%016llx 0x%016llx;\n",
-			(unsigned long long)re->re.address,
-			(unsigned long long)re->re.size);
+			write_label(ob, l->label);
+		/* "/memreserve/\t0x%016llx 0x%016llx;\n" */
+		out_str(ob, "/memreserve/\t0x");
+		out_hex(ob, re->re.address, 16);
+		out_mem(ob, " 0x", 3);
+		out_hex(ob, re->re.size, 16);
+		out_mem(ob, ";\n", 2);
 	}
 
-	write_tree_source_node(f, bi->dt, 0);
+	write_tree_source_node(ob, bi->dt, 0);
+
+	out_flush(ob);
+	free(ob);
 }
 
@@ -31,6 +31,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "libfdt.h"
 #include "util.h"
@@ -46,6 +49,103 @@ char *xstrdup(const char *s)
 	return d;
 }
 
+#define ARENA_BLOCK_SIZE	(64 * 1024)
+#define ARENA_ALIGN		16
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;		/* number of bytes available in data[] */
+	size_t used;		/* number of bytes allocated from data[] */
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+bool arena_enabled = true;
+static struct arena_block *arena_head;
+
+void *arena_alloc(size_t len)
+{
+	struct arena_block *block = arena_head;
+	void *p;
+
+	if (!arena_enabled) {
+		p = xmalloc(len);
+		memset(p, 0, len);
+		return p;
+	}
+
+	len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (!block || block->size - block->used < len) {
+		size_t size = ARENA_BLOCK_SIZE;
+
+		/* Large objects get a block to themselves */
+		if (len > size / 4)
+			size = len;
+		block = xmalloc(sizeof(*block) + size);
+		block->size = size;
+		block->used = 0;
+
+		/* Keep using the current block if it has more room left */
+		if (arena_head && size == len) {
+			block->next = arena_head->next;
+			arena_head->next = block;
+		} else {
+			block->next = arena_head;
+			arena_head = block;
+		}
+	}
+	p = block->data + block->used;
+	block->used += len;
+	memset(p, 0, len);
+
+	return p;
+}
+
+char *arena_strdup(const char *s)
+{
+	int len = strlen(s) + 1;
+	char *d = arena_alloc(len);
+
+	memcpy(d, s, len);
+
+	return d;
+}
+
+void arena_free(void *p)
+{
+	if (!arena_enabled)
+		free(p);
+}
+
+void arena_release(void)
+{
+	struct arena_block *block, *next;
+
+	for (block = arena_head; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	arena_head = NULL;
+}
+
+double util_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned int util_hash(const void *p, int len)
+{
+	const unsigned char *s = p;
+	unsigned int hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ s[i]) * 16777619;
+	return hash;
+}
+
 char *join_path(const char *path, const char *name)
 {
 	int lenp = strlen(path);
@@ -198,19 +298,60 @@ char get_escape_char(const char *s, int *i)
 	return val;
 }
 
-int utilfdt_read_err_len(const char *filename, char **buffp, off_t *len)
+int util_split_words(char *line, char ***wordsp)
 {
-	int fd = 0;	/* assume stdin */
+	char **words = NULL;
+	int count = 0, size = 0;
+	char *in = line, *out;
+	char quote;
+
+	for (;;) {
+		while (isspace((unsigned char)*in))
+			in++;
+		if (!*in || *in == '#')
+			break;
+		if (count == size) {
+			size = size ? size * 2 : 8;
+			words = xrealloc(words, size * sizeof(*words));
+		}
+		words[count++] = out = in;
+		for (quote = 0; *in && (quote || !isspace((unsigned char)*in));
+		     in++) {
+			if (quote && *in == quote)
+				quote = 0;
+			else if (!quote && (*in == '"' || *in == '\''))
+				quote = *in;
+			else if (*in == '\\' && quote != '\'' && in[1])
+				*out++ = *++in;
+			else
+				*out++ = *in;
+		}
+		if (quote) {
+			free(words);
+			return -1;
+		}
+		if (*in)
+			in++;
+		*out = '\0';
+	}
+	*wordsp = words;
+	return count;
+}
+
+/*
+ * Read everything from a file descriptor into an allocated buffer, then
+ * close it. If the file size is known the buffer is allocated once at the
+ * right size, otherwise (e.g. for a pipe) it is grown as needed.
+ */
+static int utilfdt_read_fd(int fd, char **buffp, off_t *len)
+{
+	struct stat st;
 	char *buf = NULL;
 	off_t bufsize = 1024, offset = 0;
 	int ret = 0;
 
-	*buffp = NULL;
-	if (strcmp(filename, "-") != 0) {
-		fd = open(filename, O_RDONLY);
-		if (fd < 0)
-			return errno;
-	}
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+		bufsize = st.st_size + 1;	/* room to see the EOF */
 
 	/* Loop until we have read everything */
 	buf = xmalloc(bufsize);
@@ -235,10 +376,115 @@ int utilfdt_read_err_len(const char *filename, char **buffp, off_t *len)
 		free(buf);
 	else
 		*buffp = buf;
-	*len = bufsize;
+	if (len)
+		*len = offset;
 	return ret;
 }
 
+int utilfdt_read_err_len(const char *filename, char **buffp, off_t *len)
+{
+	int fd = 0;	/* assume stdin */
+
+	*buffp = NULL;
+	if (strcmp(filename, "-") != 0) {
+		fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return errno;
+	}
+
+	return utilfdt_read_fd(fd, buffp, len);
+}
+
+/* A file mapped by utilfdt_map_err() */
+struct util_mapping {
+	char *buf;
+	size_t size;
+	struct util_mapping *next;
+};
+
+static struct util_mapping *util_mappings;
+
+/* Map an open file with the given protection (or read it), and close it */
+static int utilfdt_map_fd(int fd, char **buffp, off_t *len, int prot)
+{
+	struct util_mapping *map;
+	struct stat st;
+	void *buf;
+
+	/* Pipes, empty files and the like must be read */
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+	    st.st_size != (size_t)st.st_size)
+		return utilfdt_read_fd(fd, buffp, len);
+
+	buf = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED)
+		return utilfdt_read_fd(fd, buffp, len);
+	close(fd);
+
+	map = xmalloc(sizeof(*map));
+	map->buf = buf;
+	map->size = st.st_size;
+	map->next = util_mappings;
+	util_mappings = map;
+
+	*buffp = buf;
+	if (len)
+		*len = st.st_size;
+	return 0;
+}
+
+int utilfdt_map_err(const char *filename, char **buffp, off_t *len)
+{
+	int fd = 0;	/* assume stdin */
+
+	*buffp = NULL;
+	if (strcmp(filename, "-") != 0) {
+		fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return errno;
+	}
+
+	return utilfdt_map_fd(fd, buffp, len, PROT_READ);
+}
+
+int utilfdt_map_fd_err(int fd, char **buffp, off_t *len)
+{
+	*buffp = NULL;
+	return utilfdt_map_fd(fd, buffp, len, PROT_READ | PROT_WRITE);
+}
+
+char *utilfdt_map(const char *filename, off_t *len)
+{
+	char *buff;
+	int ret = utilfdt_map_err(filename, &buff, len);
+
+	if (ret) {
+		fprintf(stderr, "Couldn't open blob from '%s': %s\n", filename,
+			strerror(ret));
+		return NULL;
+	}
+	/* Successful read */
+	return buff;
+}
+
+void utilfdt_unmap(char *buf)
+{
+	struct util_mapping **mapp, *map;
+
+	for (mapp = &util_mappings; *mapp; mapp = &(*mapp)->next) {
+		map = *mapp;
+		if (map->buf == buf) {
+			munmap(map->buf, map->size);
+			*mapp = map->next;
+			free(map);
+			return;
+		}
+	}
+
+	/* Not mapped, so it was read into an allocated buffer */
+	free(buf);
+}
+
 int utilfdt_read_err(const char *filename, char **buffp)
 {
 	off_t len;
@@ -61,6 +61,58 @@ static inline void *xrealloc(void *p, size_t len)
 extern char *xstrdup(const char *s);
 extern char *join_path(const char *path, const char *name);
 
+/*
+ * Arena allocation, for the many small objects which make up a tree and
+ * live until the program exits. These are carved out of large blocks and
+ * released all at once with arena_release(), rather than individually.
+ * If the arena is disabled, each object is allocated with malloc() instead.
+ */
+extern bool arena_enabled;
+
+/**
+ * Allocate zeroed memory from the arena
+ *
+ * @param len	Number of bytes required
+ * @return pointer to memory, suitably aligned for any object
+ */
+extern void *arena_alloc(size_t len);
+
+/**
+ * Copy a string into the arena
+ *
+ * @param s	String to copy
+ * @return pointer to the copy
+ */
+extern char *arena_strdup(const char *s);
+
+/**
+ * Release a single object from arena_alloc() or arena_strdup(). This does
+ * nothing if the arena is enabled, since arena memory is only released as
+ * a whole.
+ *
+ * @param p	Object to release
+ */
+extern void arena_free(void *p);
+
+/* Release all arena memory */
+extern void arena_release(void);
+
+/**
+ * Get the time, for measuring how long something takes
+ *
+ * @return number of seconds since some fixed point in the past
+ */
+extern double util_now(void);
+
+/**
+ * Hash some bytes, for a hash table, with the 32-bit FNV-1a hash
+ *
+ * @param p	Bytes to hash
+ * @param len	Number of bytes
+ * @return the hash
+ */
+extern unsigned int util_hash(const void *p, int len);
+
 /**
  * Check a property of a given length to see if it is all printable and
  * has a valid terminator. The property can contain either a single string,
@@ -80,6 +132,21 @@ bool util_is_printable_string(const void *data, int len);
  */
 char get_escape_char(const char *s, int *i);
 
+/**
+ * Split a line into words, for example a line of a script.
+ *
+ * Words are separated by white space. Single or double quotes may be used
+ * to include white space in a word, and a backslash escapes the next
+ * character outside single quotes. A '#' at the start of a word starts a
+ * comment, which runs to the end of the line. The line is modified in
+ * place.
+ *
+ * @param line		Line to split
+ * @param wordsp	Returns an allocated list of pointers to the words
+ * @return number of words, or -1 if a quote is not closed
+ */
+int util_split_words(char *line, char ***wordsp);
+
 /**
  * Read a device tree file into a buffer. This will report any errors on
  * stderr.
@@ -114,6 +181,55 @@ int utilfdt_read_err(const char *filename, char **buffp);
  */
 int utilfdt_read_err_len(const char *filename, char **buffp, off_t *len);
 
+/**
+ * Map a device tree file into memory, for tools which only read it.
+ *
+ * A regular file is mapped read-only with mmap(), so that it takes
+ * constant time and memory however large it is; the buffer must not be
+ * written to. Anything else (such as stdin or a pipe) is read into an
+ * allocated buffer as with utilfdt_read_err_len(). Either way, the buffer
+ * must be released with utilfdt_unmap(). Does not report errors, but only
+ * returns them.
+ *
+ * @param filename	The filename to read, or - for stdin
+ * @param buffp		Returns pointer to buffer containing fdt
+ * @param len		If non-NULL, returns the size of the file
+ * @return 0 if ok, else an errno value representing the error
+ */
+int utilfdt_map_err(const char *filename, char **buffp, off_t *len);
+
+/**
+ * Map an open device tree file into memory, so that it can be changed.
+ *
+ * As utilfdt_map_err(), except that the buffer may be written to: a
+ * regular file is mapped copy-on-write, so that a page is only copied
+ * when it is first written and the file itself never changes. The file
+ * descriptor is closed.
+ *
+ * @param fd		The file to read
+ * @param buffp		Returns pointer to buffer containing fdt
+ * @param len		If non-NULL, returns the size of the file
+ * @return 0 if ok, else an errno value representing the error
+ */
+int utilfdt_map_fd_err(int fd, char **buffp, off_t *len);
+
+/**
+ * Like utilfdt_map_err(), but reports errors on stderr.
+ *
+ * @param filename	The filename to read, or - for stdin
+ * @param len		If non-NULL, returns the size of the file
+ * @return Pointer to buffer containing fdt, or NULL on error
+ */
+char *utilfdt_map(const char *filename, off_t *len);
+
+/**
+ * Release a buffer returned by utilfdt_map(), utilfdt_map_err() or
+ * utilfdt_map_fd_err().
+ *
+ * @param buf		Buffer to release
+ */
+void utilfdt_unmap(char *buf);
+
 /**
  * Write a device tree buffer to a file. This will report any errors on
  * stderr.